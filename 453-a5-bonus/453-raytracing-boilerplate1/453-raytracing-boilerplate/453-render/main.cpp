@@ -0,0 +1,206 @@
+//------------------------------------------------------------------------------
+// Renders one of the scenes to a PNG file without opening a window, e.g. on a
+// machine without a display or to time the ray tracer.
+//
+//   453-render --scene 2 --width 1920 --height 1080 --spp 4 --out scene2.png
+//
+// It also turns OBJ files into mesh files (see MeshFile.h), and renders those:
+//
+//   453-render --convert bunny.obj bunny.mesh
+//   453-render --mesh bunny.mesh --budget 256 --out bunny.png
+//------------------------------------------------------------------------------
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include <argh.h>
+
+#include "Framebuffer.h"
+#include "Log.h"
+#include "MeshFile.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "TileScheduler.h"
+
+// Renders frames 0 .. frames-1 of the scene's animation. Each frame updates
+// the BVH of the one before it rather than building a new one.
+int renderAnimation(Scene const &scene, Framebuffer &image, TileScheduler &scheduler, RenderSettings const &settings, int frames, float fps, std::string const &outFile) {
+	std::string stem = outFile;
+	std::string extension = ".png";
+	size_t dot = outFile.rfind('.');
+	if (dot != std::string::npos && outFile.find_first_of("/\\", dot) == std::string::npos) {
+		stem = outFile.substr(0, dot);
+		extension = outFile.substr(dot);
+	}
+
+	Scene frame = scene;
+	for (int i = 0; i < frames; i++) {
+		auto start = std::chrono::steady_clock::now();
+		if (i > 0) {
+			frame = sceneAtTime(frame, i / fps);
+		}
+		auto updated = std::chrono::steady_clock::now();
+		raytraceImage(frame, image, glm::vec3(0, 0, 1.3), scheduler, settings);
+		auto traced = std::chrono::steady_clock::now();
+		Log::info("Frame {}: {} shapes moved, scene updated in {:.0f} us, traced in {:.3f} s", i, i > 0 ? frame.animations.size() : 0,
+			std::chrono::duration<double, std::micro>(updated - start).count(), std::chrono::duration<double>(traced - updated).count());
+
+		char number[16];
+		std::snprintf(number, sizeof(number), "_%04d", i);
+		if (!image.SaveToFile(stem + number + extension)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Reads an OBJ file and writes it out as a mesh file, BVH and all
+int convertMesh(std::string const &objFile, std::string const &meshFile) {
+	auto start = std::chrono::steady_clock::now();
+	std::vector<glm::vec3> corners;
+	if (!readObj(objFile, corners)) {
+		return 1;
+	}
+	auto read = std::chrono::steady_clock::now();
+	Triangles mesh;
+	int count = static_cast<int>(corners.size() / 3);
+	mesh.initTriangles(count, corners.data(), 1);
+	// The mesh has its own copy now, don't hold on to two
+	std::vector<glm::vec3>().swap(corners);
+	auto built = std::chrono::steady_clock::now();
+	if (!writeMeshFile(mesh, meshFile)) {
+		return 1;
+	}
+	auto written = std::chrono::steady_clock::now();
+	Log::info("Converted {} triangles: read in {:.3f} s, BVH built in {:.3f} s, written in {:.3f} s", count,
+		std::chrono::duration<double>(read - start).count(), std::chrono::duration<double>(built - read).count(), std::chrono::duration<double>(written - built).count());
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	// --scene N picks the scene to render (1 to 4, default: 1)
+	// --accel bvh|grid puts BVHs or a uniform grid over the shapes (default: what the scene uses)
+	// --width W --height H set the image size (default: 800 x 800)
+	// --spp N traces N camera rays per pixel (default: 1)
+	// --no-packets traces camera rays one at a time instead of in 4x4 packets
+	// --adaptive only spends more than one ray on pixels near edges, up to --spp
+	// --threshold T is how different pixels may be before they get more rays (default: 0.05)
+	// --min-throughput W stops following reflections that add less than W to the pixel (default: 1/256)
+	// --roulette follows some of those anyway, weighted up to make up for the rest
+	// --wavefront traces big batches of rays a stage at a time instead of pixel by pixel
+	// --sort-rays sorts reflection and refraction rays by direction in wavefront mode
+	// --order tiled|morton|hilbert is the order tiles and the pixels in them are traced in
+	// --threads N picks how many threads to ray trace with (default: all cores)
+	// --out FILE is where the image is written (default: render.png)
+	// --frames N renders N frames of the scene's animation instead, to FILE_0000.png and on
+	// --fps F is the number of frames per second of animation time (default: 24)
+	// --convert OBJ MESH turns an OBJ file into a mesh file and stops
+	// --mesh FILE renders the mesh in a mesh file instead of one of the scenes
+	// --budget MB keeps at most that much of the mesh file in memory (default: no limit)
+	argh::parser cmdl(argc, argv, argh::parser::PREFER_PARAM_FOR_UNREG_OPTION);
+	int sceneNumber = 1;
+	int width = 800;
+	int height = 800;
+	int threads = 0;
+	std::string outFile;
+	int frames = 0;
+	float fps = 24.0f;
+	RenderSettings settings;
+	cmdl("scene", 1) >> sceneNumber;
+	cmdl("width", 800) >> width;
+	cmdl("height", 800) >> height;
+	cmdl("spp", 1) >> settings.samplesPerPixel;
+	settings.packets = !cmdl["no-packets"];
+	settings.adaptiveSampling = cmdl["adaptive"];
+	cmdl("threshold", 0.05f) >> settings.adaptiveThreshold;
+	cmdl("min-throughput", 1.0f / 256.0f) >> settings.minThroughput;
+	settings.russianRoulette = cmdl["roulette"];
+	settings.wavefront = cmdl["wavefront"];
+	settings.sortSecondaryRays = cmdl["sort-rays"];
+	std::string order;
+	cmdl("order", "tiled") >> order;
+	if (!parseTraversalOrder(order, settings.pixelOrder)) {
+		Log::error("Unknown pixel order {}, use tiled, morton or hilbert", order);
+		return 1;
+	}
+	cmdl("threads", 0) >> threads;
+	cmdl("out", "render.png") >> outFile;
+	cmdl("frames", 0) >> frames;
+	cmdl("fps", 24.0f) >> fps;
+	std::string meshFile;
+	cmdl("mesh") >> meshFile;
+	size_t budget = 0;
+	cmdl("budget", 0) >> budget;
+	std::string objFile;
+	cmdl("convert") >> objFile;
+	if (!objFile.empty()) {
+		if (cmdl.pos_args().size() != 2) {
+			Log::error("--convert needs an OBJ file to read and a mesh file to write");
+			return 1;
+		}
+		return convertMesh(objFile, cmdl.pos_args()[1]);
+	}
+	std::string accel;
+	cmdl("accel") >> accel;
+	AccelStructure structure = AccelStructure::BVH;
+	if (!accel.empty() && !parseAccelStructure(accel, structure)) {
+		Log::error("Unknown acceleration structure {}, use bvh or grid", accel);
+		return 1;
+	}
+
+	if (sceneNumber < 1 || sceneNumber > 4) {
+		Log::error("There is no scene {}, pick 1 to 4", sceneNumber);
+		return 1;
+	}
+	if (width <= 0 || height <= 0 || settings.samplesPerPixel <= 0) {
+		Log::error("Width, height and samples per pixel have to be positive");
+		return 1;
+	}
+	if (frames < 0 || fps <= 0.0f) {
+		Log::error("The number of frames can't be negative, and frames per second have to be positive");
+		return 1;
+	}
+
+	std::shared_ptr<Triangles> mesh;
+	Scene scene;
+	if (!meshFile.empty()) {
+		auto start = std::chrono::steady_clock::now();
+		mesh = openMeshFile(meshFile, budget * 1024 * 1024, 1);
+		if (!mesh) {
+			return 1;
+		}
+		std::chrono::duration<double, std::milli> opened = std::chrono::steady_clock::now() - start;
+		Log::info("Opened {} ({} triangles) in {:.2f} ms", meshFile, mesh->soa.count, opened.count());
+		scene = initMeshScene(mesh);
+	} else {
+		scene = sceneNumber == 1 ? initScene1() : sceneNumber == 2 ? initScene2() : sceneNumber == 3 ? initScene3() : initScene4();
+	}
+	if (!accel.empty() && structure != scene.structure) {
+		scene.structure = structure;
+		buildSceneBVH(scene);
+	}
+	TileScheduler scheduler(threads);
+	Framebuffer image;
+	image.Resize(width, height);
+
+	Log::info("Rendering {} at {}x{}, {} samples per pixel, with {}, on {} threads", meshFile.empty() ? fmt::format("scene {}", sceneNumber) : meshFile,
+		width, height, settings.samplesPerPixel,
+		accelStructureName(scene.structure), scheduler.threadCount());
+	if (frames > 0) {
+		return renderAnimation(scene, image, scheduler, settings, frames, fps, outFile);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	raytraceImage(scene, image, glm::vec3(0, 0, 1.3), scheduler, settings);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	Log::info("Rendered in {:.3f} s", elapsed.count());
+	if (mesh) {
+		Log::info("{:.1f} MB of the {:.1f} MB mesh file in memory, {} blocks of it released", mesh->pages->residentBytes() / 1048576.0,
+			mesh->pages->file().size() / 1048576.0, mesh->pages->evictions());
+	}
+
+	if (!image.SaveToFile(outFile)) {
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,48 @@
+#include "AllocationCounter.h"
+
+#ifdef COUNT_ALLOCATIONS
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+// Per thread, so the render threads don't fight over one counter
+thread_local uint64_t allocations = 0;
+}
+
+// The array forms of new and delete forward to these by default
+void *operator new(std::size_t size) {
+	allocations++;
+	if (void *p = std::malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+	std::free(p);
+}
+
+bool allocationCountingEnabled() {
+	return true;
+}
+
+uint64_t allocationCount() {
+	return allocations;
+}
+
+#else
+
+bool allocationCountingEnabled() {
+	return false;
+}
+
+uint64_t allocationCount() {
+	return 0;
+}
+
+#endif
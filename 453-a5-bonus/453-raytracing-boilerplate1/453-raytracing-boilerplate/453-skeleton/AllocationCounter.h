@@ -0,0 +1,16 @@
+//------------------------------------------------------------------------------
+// Counts heap allocations, to check that tracing a ray never allocates.
+//
+// Counting replaces the global operator new, so it is only compiled in when
+// the project is configured with -DCOUNT_ALLOCATIONS=ON. Otherwise the count
+// is always 0.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+
+// Whether this build counts allocations at all
+bool allocationCountingEnabled();
+
+// Number of allocations made so far by the calling thread
+uint64_t allocationCount();
@@ -0,0 +1,333 @@
+#include "BVH.h"
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <limits>
+#include <thread>
+
+#include "Parallel.h"
+
+namespace {
+
+// Number of buckets the centroids are sorted into when looking for a split
+const int SAH_BINS = 16;
+
+// Relative cost of visiting a node compared to intersecting one primitive
+const float SAH_TRAVERSAL_COST = 1.0f;
+
+// Nodes with more primitives than this are binned on several threads, and
+// their children are built in parallel.
+const int PARALLEL_THRESHOLD = 16 * 1024;
+
+// Past this depth we stop looking for good splits and just halve the
+// primitives, so the traversal stack can't overflow.
+const int MAX_SAH_DEPTH = 64;
+
+// Grows the box a tiny bit. A ray that runs exactly along the face of a box
+// produces 0 * inf = NaN in the slab test and would miss a primitive that
+// only just touches that face (e.g. the top of a sphere).
+AABB padded(AABB b) {
+	glm::vec3 eps = 1e-5f * glm::max(glm::vec3(1.0f), glm::max(glm::abs(b.min), glm::abs(b.max)));
+	b.min -= eps;
+	b.max += eps;
+	return b;
+}
+
+struct Bin {
+	AABB bounds;
+	int count = 0;
+};
+
+struct SplitCandidates {
+	Bin bins[3][SAH_BINS];
+
+	void merge(SplitCandidates const &other) {
+		for (int axis = 0; axis < 3; axis++) {
+			for (int b = 0; b < SAH_BINS; b++) {
+				bins[axis][b].bounds.extend(other.bins[axis][b].bounds);
+				bins[axis][b].count += other.bins[axis][b].count;
+			}
+		}
+	}
+};
+
+class Builder {
+public:
+	Builder(std::vector<AABB> const &primBounds, std::vector<glm::vec3> const &centroids, BVH &bvh, int maxLeafSize, int leafBatchSize)
+		: primBounds(primBounds)
+		, centroids(centroids)
+		, nodes(bvh.nodes)
+		, primitives(bvh.primitives)
+		, maxLeafSize(maxLeafSize)
+		, leafBatchSize(leafBatchSize)
+	{
+		int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+		maxThreads = hardwareThreads;
+		// Only fork while there are fewer subtrees than threads to run them
+		while ((1 << spawnDepth) < hardwareThreads) {
+			spawnDepth++;
+		}
+	}
+
+	int build() {
+		int count = static_cast<int>(primitives.size());
+		nodes.resize(2 * count - 1);
+		nodes[0] = { AABB(), 0, count };
+		nodeCount = 1;
+		subdivide(0, 0);
+		return nodeCount;
+	}
+
+private:
+	std::vector<AABB> const &primBounds;
+	std::vector<glm::vec3> const &centroids;
+	std::vector<BVHNode> &nodes;
+	std::vector<int> &primitives;
+	int maxLeafSize;
+	int leafBatchSize;
+	int maxThreads = 1;
+	int spawnDepth = 0;
+
+	// Children are allocated in pairs from here, so subtrees can be built
+	// on different threads without stepping on each other.
+	std::atomic<int> nodeCount{0};
+
+	// SAH cost of intersecting n primitives, when they are tested leafBatchSize at a time
+	float intersectionCost(int n) const {
+		return static_cast<float>((n + leafBatchSize - 1) / leafBatchSize);
+	}
+
+	int chunksFor(int count) const {
+		if (count < PARALLEL_THRESHOLD) {
+			return 1;
+		}
+		return std::min(maxThreads, count / (PARALLEL_THRESHOLD / 4));
+	}
+
+	void computeBounds(int first, int count, AABB &bounds, AABB &centroidBounds) const {
+		int chunks = chunksFor(count);
+		if (chunks == 1) {
+			for (int i = first; i < first + count; i++) {
+				bounds.extend(primBounds[primitives[i]]);
+				centroidBounds.extend(centroids[primitives[i]]);
+			}
+			return;
+		}
+		std::vector<AABB> chunkBounds(chunks), chunkCentroids(chunks);
+		parallelChunks(first, first + count, chunks, [&](int c, int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				chunkBounds[c].extend(primBounds[primitives[i]]);
+				chunkCentroids[c].extend(centroids[primitives[i]]);
+			}
+		});
+		for (int c = 0; c < chunks; c++) {
+			bounds.extend(chunkBounds[c]);
+			centroidBounds.extend(chunkCentroids[c]);
+		}
+	}
+
+	void binRange(int begin, int end, int binCount, glm::vec3 lo, glm::vec3 scale, SplitCandidates &result) const {
+		for (int i = begin; i < end; i++) {
+			int prim = primitives[i];
+			glm::vec3 b = (centroids[prim] - lo) * scale;
+			for (int axis = 0; axis < 3; axis++) {
+				int bin = std::min(static_cast<int>(b[axis]), binCount - 1);
+				result.bins[axis][bin].bounds.extend(primBounds[prim]);
+				result.bins[axis][bin].count++;
+			}
+		}
+	}
+
+	void binCentroids(int first, int count, int binCount, glm::vec3 lo, glm::vec3 scale, SplitCandidates &result) const {
+		int chunks = chunksFor(count);
+		if (chunks == 1) {
+			binRange(first, first + count, binCount, lo, scale, result);
+			return;
+		}
+		std::vector<SplitCandidates> chunkBins(chunks);
+		parallelChunks(first, first + count, chunks, [&](int c, int begin, int end) {
+			binRange(begin, end, binCount, lo, scale, chunkBins[c]);
+		});
+		result = chunkBins[0];
+		for (int c = 1; c < chunks; c++) {
+			result.merge(chunkBins[c]);
+		}
+	}
+
+	// Finds where to split [first, first + count). Returns the index of the first
+	// primitive of the right child, or -1 if this node should stay a leaf.
+	int findSplit(int first, int count, int depth, AABB const &bounds, AABB const &centroidBounds) {
+		glm::vec3 extent = centroidBounds.extent();
+		int mid = first + count / 2;
+
+		if (extent.x <= 0.0f && extent.y <= 0.0f && extent.z <= 0.0f) {
+			// Every centroid is in the same spot, no plane can separate them.
+			return count <= maxLeafSize ? -1 : mid;
+		}
+
+		int widest = 0;
+		if (extent.y > extent[widest]) widest = 1;
+		if (extent.z > extent[widest]) widest = 2;
+		auto medianSplit = [&]() {
+			std::nth_element(
+				primitives.begin() + first, primitives.begin() + mid, primitives.begin() + first + count,
+				[&](int a, int b) { return centroids[a][widest] < centroids[b][widest]; }
+			);
+			return mid;
+		};
+		if (depth >= MAX_SAH_DEPTH) {
+			return medianSplit();
+		}
+
+		// Small nodes don't need as many bins as they have primitives
+		int binCount = std::min(SAH_BINS, count);
+		glm::vec3 scale;
+		for (int axis = 0; axis < 3; axis++) {
+			scale[axis] = extent[axis] > 0.0f ? binCount * 0.9999f / extent[axis] : 0.0f;
+		}
+		SplitCandidates candidates;
+		binCentroids(first, count, binCount, centroidBounds.min, scale, candidates);
+
+		// Sweep the bins from both ends to get the cost of splitting after each one
+		float bestCost = std::numeric_limits<float>::max();
+		int bestAxis = -1, bestBin = -1;
+		for (int axis = 0; axis < 3; axis++) {
+			if (extent[axis] <= 0.0f) {
+				continue;
+			}
+			Bin const *bins = candidates.bins[axis];
+			float rightCost[SAH_BINS];
+			AABB right;
+			int rightCount = 0;
+			for (int b = binCount - 1; b > 0; b--) {
+				right.extend(bins[b].bounds);
+				rightCount += bins[b].count;
+				rightCost[b] = rightCount ? right.surfaceArea() * intersectionCost(rightCount) : 0.0f;
+			}
+			AABB left;
+			int leftCount = 0;
+			for (int b = 0; b < binCount - 1; b++) {
+				left.extend(bins[b].bounds);
+				leftCount += bins[b].count;
+				if (leftCount == 0 || leftCount == count) {
+					continue;
+				}
+				float cost = left.surfaceArea() * intersectionCost(leftCount) + rightCost[b + 1];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = b;
+				}
+			}
+		}
+
+		if (bestAxis < 0) {
+			return count <= maxLeafSize ? -1 : medianSplit();
+		}
+
+		float leafCost = intersectionCost(count);
+		float splitCost = SAH_TRAVERSAL_COST + bestCost / bounds.surfaceArea();
+		if (count <= maxLeafSize && leafCost <= splitCost) {
+			return -1;
+		}
+
+		float lo = centroidBounds.min[bestAxis];
+		float axisScale = scale[bestAxis];
+		auto split = std::partition(
+			primitives.begin() + first, primitives.begin() + first + count,
+			[&](int prim) { return std::min(static_cast<int>((centroids[prim][bestAxis] - lo) * axisScale), binCount - 1) <= bestBin; }
+		);
+		int splitIndex = static_cast<int>(split - primitives.begin());
+		if (splitIndex == first || splitIndex == first + count) {
+			return medianSplit();
+		}
+		return splitIndex;
+	}
+
+	void subdivide(int nodeIndex, int depth) {
+		int first = nodes[nodeIndex].first;
+		int count = nodes[nodeIndex].count;
+
+		AABB bounds, centroidBounds;
+		computeBounds(first, count, bounds, centroidBounds);
+		nodes[nodeIndex].bounds = bounds;
+
+		if (count == 1) {
+			return;
+		}
+		int mid = findSplit(first, count, depth, bounds, centroidBounds);
+		if (mid < 0) {
+			return;
+		}
+
+		int left = nodeCount.fetch_add(2);
+		nodes[left] = { AABB(), first, mid - first };
+		nodes[left + 1] = { AABB(), mid, first + count - mid };
+		nodes[nodeIndex].first = left;
+		nodes[nodeIndex].count = 0;
+
+		if (count >= PARALLEL_THRESHOLD && depth < spawnDepth) {
+			auto leftDone = std::async(std::launch::async, [this, left, depth] { subdivide(left, depth + 1); });
+			subdivide(left + 1, depth + 1);
+			leftDone.get();
+		} else {
+			subdivide(left, depth + 1);
+			subdivide(left + 1, depth + 1);
+		}
+	}
+};
+
+} // namespace
+
+void BVH::build(std::vector<AABB> const &shapeBounds, int maxLeafSize, int leafBatchSize) {
+	nodes.clear();
+	primitives.clear();
+	if (shapeBounds.empty()) {
+		return;
+	}
+
+	std::vector<AABB> primBounds(shapeBounds);
+	for (AABB &b : primBounds) {
+		b = padded(b);
+	}
+
+	std::vector<glm::vec3> centroids;
+	centroids.reserve(primBounds.size());
+	for (size_t i = 0; i < primBounds.size(); i++) {
+		primitives.push_back(static_cast<int>(i));
+		centroids.push_back(primBounds[i].centre());
+	}
+
+	Builder builder(primBounds, centroids, *this, std::max(1, maxLeafSize), std::max(1, leafBatchSize));
+	nodes.resize(builder.build());
+}
+
+void BVH::refit(std::vector<AABB> const &leafBounds) {
+	// Children are always allocated after their parent, so going backwards
+	// visits both children of a node before the node itself
+	for (int n = static_cast<int>(nodes.size()) - 1; n >= 0; n--) {
+		BVHNode &node = nodes[n];
+		AABB box;
+		if (node.isLeaf()) {
+			for (int i = node.first; i < node.first + node.count; i++) {
+				box.extend(padded(leafBounds[i]));
+			}
+		} else {
+			box.extend(nodes[node.first].bounds);
+			box.extend(nodes[node.first + 1].bounds);
+		}
+		node.bounds = box;
+	}
+}
+
+float BVH::sahCost() const {
+	if (nodes.empty()) {
+		return 0.0f;
+	}
+	float cost = 0.0f;
+	for (BVHNode const &node : nodes) {
+		cost += node.bounds.surfaceArea() * (node.isLeaf() ? static_cast<float>(node.count) : SAH_TRAVERSAL_COST);
+	}
+	return cost / std::max(nodes[0].bounds.surfaceArea(), std::numeric_limits<float>::min());
+}
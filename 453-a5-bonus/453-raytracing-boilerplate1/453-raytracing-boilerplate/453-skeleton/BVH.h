@@ -0,0 +1,218 @@
+//------------------------------------------------------------------------------
+// A bounding volume hierarchy over a set of primitives that are only known by
+// their bounding boxes. The BVH doesn't know what the primitives are, it just
+// tells the caller which ones a ray could hit, nearest first.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <vector>
+
+#include "Ray.h"
+#include "RayPacket.h"
+
+struct BVHNode {
+	AABB bounds;
+	int first; // leaf: first entry in BVH::primitives, interior: index of the left child (right child is first + 1)
+	int count; // leaf: number of primitives, interior: 0
+
+	bool isLeaf() const { return count > 0; }
+};
+
+class BVH {
+public:
+	std::vector<BVHNode> nodes;    // nodes[0] is the root
+	std::vector<int> primitives;   // primitive indices, in leaf order
+
+	// Builds the hierarchy for primitives 0 .. shapeBounds.size()-1 using the
+	// surface area heuristic. Big nodes are binned and split on several threads.
+	// Leaves hold at most maxLeafSize primitives (unless they can't be told apart).
+	// If the caller tests leafBatchSize primitives of a leaf for the price of one,
+	// say so, and the builder will make leaves that fill those batches.
+	void build(std::vector<AABB> const &shapeBounds, int maxLeafSize = 4, int leafBatchSize = 1);
+
+	bool empty() const { return nodes.empty(); }
+
+	// Recomputes the node bounds bottom up after primitives moved, keeping the
+	// tree as it is, in O(nodes). leafBounds[i] is the new box of primitive
+	// primitives[i] (the order the leaves reference them in).
+	void refit(std::vector<AABB> const &leafBounds);
+
+	// Expected cost of tracing a ray through the tree by the surface area
+	// heuristic, relative to just testing the root box. Refitting after
+	// things moved makes it go up; comparing it with the cost right after
+	// build() tells how much worse the tree has got.
+	float sahCost() const;
+
+	// Closest hit traversal. Calls intersectPrim(prim, tMax) for every primitive
+	// in a leaf the ray reaches before tMax; intersectPrim should lower tMax when
+	// it finds a closer hit so that more of the tree can be skipped.
+	template <typename F>
+	void traverse(Ray const &ray, float &tMax, F &&intersectPrim) const;
+
+	// Any hit traversal. Stops as soon as occludedPrim(prim) returns true.
+	template <typename F>
+	bool traverseAny(Ray const &ray, float tMax, F &&occludedPrim) const;
+
+	// Same as above, but hand over whole leaves, for callers that store their
+	// primitives in leaf order and can test a leaf's worth at once.
+	template <typename F>
+	void traverseLeaves(Ray const &ray, float &tMax, F &&intersectLeaf) const;
+	template <typename F>
+	bool traverseLeavesAny(Ray const &ray, float tMax, F &&occludedLeaf) const;
+
+	// Closest hit traversal for a packet of rays. tMax holds one value per lane.
+	// Calls intersectLeaf(leaf, lanes) with the lanes of `active` that reach
+	// the leaf; it should lower tMax for lanes that hit something.
+	template <typename F>
+	void traversePacket(RayPacket const &packet, uint32_t active, float *tMax, F &&intersectLeaf) const;
+};
+
+// -----------------------------------------------------------------------------
+
+template <typename F>
+void BVH::traverse(Ray const &ray, float &tMax, F &&intersectPrim) const {
+	traverseLeaves(ray, tMax, [&](BVHNode const &leaf, float &tMax) {
+		for (int i = leaf.first; i < leaf.first + leaf.count; i++) {
+			intersectPrim(primitives[i], tMax);
+		}
+	});
+}
+
+template <typename F>
+bool BVH::traverseAny(Ray const &ray, float tMax, F &&occludedPrim) const {
+	return traverseLeavesAny(ray, tMax, [&](BVHNode const &leaf) {
+		for (int i = leaf.first; i < leaf.first + leaf.count; i++) {
+			if (occludedPrim(primitives[i])) {
+				return true;
+			}
+		}
+		return false;
+	});
+}
+
+template <typename F>
+void BVH::traverseLeaves(Ray const &ray, float &tMax, F &&intersectLeaf) const {
+	if (nodes.empty()) {
+		return;
+	}
+
+	glm::vec3 invDir = 1.0f / ray.direction;
+	float tNear;
+	if (!nodes[0].bounds.intersect(ray.origin, invDir, tMax, tNear)) {
+		return;
+	}
+
+	// Each stack entry remembers where the ray entered the node so that nodes
+	// behind an already found hit can be skipped when they are popped.
+	struct Entry { int node; float tNear; };
+	Entry stack[128];
+	int size = 0;
+	stack[size++] = { 0, tNear };
+
+	while (size > 0) {
+		Entry e = stack[--size];
+		if (e.tNear > tMax) {
+			continue;
+		}
+		BVHNode const &node = nodes[e.node];
+		if (node.isLeaf()) {
+			intersectLeaf(node, tMax);
+			continue;
+		}
+
+		// Visit the nearer child first
+		float tLeft, tRight;
+		bool hitLeft = nodes[node.first].bounds.intersect(ray.origin, invDir, tMax, tLeft);
+		bool hitRight = nodes[node.first + 1].bounds.intersect(ray.origin, invDir, tMax, tRight);
+		if (hitLeft && hitRight) {
+			if (tLeft <= tRight) {
+				stack[size++] = { node.first + 1, tRight };
+				stack[size++] = { node.first, tLeft };
+			} else {
+				stack[size++] = { node.first, tLeft };
+				stack[size++] = { node.first + 1, tRight };
+			}
+		} else if (hitLeft) {
+			stack[size++] = { node.first, tLeft };
+		} else if (hitRight) {
+			stack[size++] = { node.first + 1, tRight };
+		}
+	}
+}
+
+template <typename F>
+bool BVH::traverseLeavesAny(Ray const &ray, float tMax, F &&occludedLeaf) const {
+	if (nodes.empty()) {
+		return false;
+	}
+
+	glm::vec3 invDir = 1.0f / ray.direction;
+	int stack[128];
+	int size = 0;
+	stack[size++] = 0;
+
+	while (size > 0) {
+		BVHNode const &node = nodes[stack[--size]];
+		float tNear;
+		if (!node.bounds.intersect(ray.origin, invDir, tMax, tNear)) {
+			continue;
+		}
+		if (node.isLeaf()) {
+			if (occludedLeaf(node)) {
+				return true;
+			}
+			continue;
+		}
+		stack[size++] = node.first + 1;
+		stack[size++] = node.first;
+	}
+	return false;
+}
+
+template <typename F>
+void BVH::traversePacket(RayPacket const &packet, uint32_t active, float *tMax, F &&intersectLeaf) const {
+	if (nodes.empty()) {
+		return;
+	}
+
+	float tNear;
+	uint32_t rootLanes = packet.intersect(nodes[0].bounds, active, tMax, tNear);
+	if (!rootLanes) {
+		return;
+	}
+
+	// Lanes that reached a node are remembered with it. They are a superset of
+	// the lanes that still need it by the time it is popped, which is fine.
+	struct Entry { int node; uint32_t lanes; };
+	Entry stack[128];
+	int size = 0;
+	stack[size++] = { 0, rootLanes };
+
+	while (size > 0) {
+		Entry e = stack[--size];
+		BVHNode const &node = nodes[e.node];
+		if (node.isLeaf()) {
+			intersectLeaf(node, e.lanes);
+			continue;
+		}
+
+		float tLeft, tRight;
+		uint32_t left = packet.intersect(nodes[node.first].bounds, e.lanes, tMax, tLeft);
+		uint32_t right = packet.intersect(nodes[node.first + 1].bounds, e.lanes, tMax, tRight);
+
+		// Visit the child that the packet reaches first before the other one
+		if (left && right) {
+			if (tLeft <= tRight) {
+				stack[size++] = { node.first + 1, right };
+				stack[size++] = { node.first, left };
+			} else {
+				stack[size++] = { node.first, left };
+				stack[size++] = { node.first + 1, right };
+			}
+		} else if (left) {
+			stack[size++] = { node.first, left };
+		} else if (right) {
+			stack[size++] = { node.first + 1, right };
+		}
+	}
+}
@@ -0,0 +1,52 @@
+#define _USE_MATH_DEFINES
+#include <cmath>
+
+#include "Camera.h"
+
+CameraRays::CameraRays(int width, int height, glm::vec3 viewPoint)
+	: viewPoint(viewPoint)
+	, width(width)
+	, height(height)
+	, columnX(width)
+	, rowY(height)
+	, planeZ(-1.0f - viewPoint.z)
+{
+	//part 1
+	float aspectRatio = static_cast<float>(width) / height;
+	float fov = M_PI / 2.0f;
+	float scale = tan(fov / 2.0f);
+	uScale = scale * aspectRatio;
+	vScale = scale;
+
+	for (int x = 0; x < width; x++) {
+		float u = (2.0f * (x+0.5f) / float(width) - 1.0f) * uScale;
+		columnX[x] = u - viewPoint.x;
+	}
+	for (int y = 0; y < height; y++) {
+		float v = (2.0f * y / float(height) - 1.0f) * vScale;
+		rowY[y] = v - viewPoint.y;
+	}
+}
+
+Ray CameraRays::rayThrough(float px, float py) const {
+	float u = (2.0f * px / float(width) - 1.0f) * uScale;
+	float v = (2.0f * py / float(height) - 1.0f) * vScale;
+	return Ray(viewPoint, glm::normalize(glm::vec3(u - viewPoint.x, v - viewPoint.y, planeZ)));
+}
+
+// The index-th point of the radical inverse (van der Corput) sequence in the
+// given base, in [0, 1)
+static float radicalInverse(int index, int base) {
+	float result = 0.0f;
+	float digitWeight = 1.0f / base;
+	while (index > 0) {
+		result += (index % base) * digitWeight;
+		index /= base;
+		digitWeight /= base;
+	}
+	return result;
+}
+
+glm::vec2 pixelSampleOffset(int index) {
+	return glm::vec2(radicalInverse(index + 1, 2), radicalInverse(index + 1, 3) - 0.5f);
+}
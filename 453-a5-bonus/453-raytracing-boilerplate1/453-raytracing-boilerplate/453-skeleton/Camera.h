@@ -0,0 +1,44 @@
+//------------------------------------------------------------------------------
+// The camera rays of an image, generated on demand.
+//
+// Every pixel's ray goes from the view point through a point on the image
+// plane at z = -1. That point only depends on the pixel's column (for u) and
+// its row (for v), so both are worked out once per column / row up front, and
+// a ray costs a subtraction and a normalize.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Ray.h"
+
+// Where the index-th ray of a pixel goes, as an offset from (x, y) in
+// CameraRays::rayThrough coordinates: the ray goes through
+// rayThrough(x + offset.x, y + offset.y). Pixel (x, y) covers [x, x + 1) x
+// [y - 0.5, y + 0.5), so x offsets are in [0, 1) and y offsets in
+// [-0.5, 0.5). They are Halton points (bases 2 and 3), which cover the pixel
+// evenly for any number of rays.
+glm::vec2 pixelSampleOffset(int index);
+
+class CameraRays {
+public:
+	CameraRays(int width, int height, glm::vec3 viewPoint);
+
+	// Ray through pixel (x, y), where y = 0 is the bottom row
+	Ray ray(int x, int y) const {
+		return Ray(viewPoint, glm::normalize(glm::vec3(columnX[x], rowY[y], planeZ)));
+	}
+
+	// Ray through any point of the image, in pixel units: ray(x, y) is the
+	// same as rayThrough(x + 0.5, y)
+	Ray rayThrough(float px, float py) const;
+
+private:
+	glm::vec3 viewPoint;
+	float uScale, vScale;       // half the width / height of the image plane
+	int width, height;
+	std::vector<float> columnX; // x of (image plane point - view point), per column
+	std::vector<float> rowY;    // y of the same, per row
+	float planeZ;               // and its z, the same for every pixel
+};
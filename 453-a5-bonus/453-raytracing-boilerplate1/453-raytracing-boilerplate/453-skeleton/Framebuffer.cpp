@@ -0,0 +1,118 @@
+// ==========================================================================
+// CPU side image memory, split out of ImageBuffer
+//
+// Authors: Sonny Chan, Alex Brown
+//          University of Calgary
+// Date:    2016-2018
+// ==========================================================================
+
+#include <iostream>
+#include <glm/common.hpp>
+
+#include "Framebuffer.h"
+
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb/stb_image_write.h"
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+Framebuffer::Framebuffer()
+    : m_width(0), m_height(0), m_modified(false)
+{
+    ResetModified();
+}
+
+void Framebuffer::ResetModified()
+{
+    m_modified = false;
+    m_modifiedLower = m_height;
+    m_modifiedUpper = 0;
+}
+
+// --------------------------------------------------------------------------
+
+void Framebuffer::Resize(int width, int height)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_width = width;
+    m_height = height;
+
+    // allocate image data
+    m_imageData.resize(m_width * m_height);
+    for (int i = 0, k = 0; i < m_height; ++i)
+        for (int j = 0; j < m_width; ++j, ++k)
+        {
+            int p = (i >> 4) + (j >> 4);
+            float c = 0.2 + ((p & 1) ? 0.1f : 0.0f);
+            m_imageData[k] = vec3(c);
+        }
+    ResetModified();
+}
+
+// --------------------------------------------------------------------------
+
+void Framebuffer::SetPixel(int x, int y, vec3 colour)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    int index = y * m_width + x;
+    m_imageData[index] = colour;
+
+    // mark that something was changed
+    m_modified = true;
+    m_modifiedLower = std::min(m_modifiedLower, y);
+    m_modifiedUpper = std::max(m_modifiedUpper, y+1);
+}
+
+void Framebuffer::SetPixels(int x, int y, int width, int height, const vec3 *colours)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (int row = 0; row < height; ++row)
+        std::copy(colours + row * width, colours + (row + 1) * width,
+                  m_imageData.begin() + (y + row) * m_width + x);
+
+    // mark that something was changed
+    m_modified = true;
+    m_modifiedLower = std::min(m_modifiedLower, y);
+    m_modifiedUpper = std::max(m_modifiedUpper, y+height);
+}
+
+// --------------------------------------------------------------------------
+
+bool Framebuffer::SaveToFile(const string &imageFileName) const
+{
+    if (m_width == 0 || m_height == 0)
+    {
+        cout << "Framebuffer ERROR: Trying to save uninitialized image!" << endl;
+        return false;
+    }
+    cout << "Framebuffer saving image to " << imageFileName << "..." << endl;
+
+    const unsigned numComponents = 3; //RGB
+    std::vector<unsigned char> pixels(m_width*m_height*numComponents);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (int y = 0; y < m_height; ++y)
+        for (int x = 0; x < m_width; ++x)
+        {
+            const glm::vec3& color = m_imageData[y * m_width + x];
+            int i = (m_height - 1 - y) * m_width + x;
+            i *= numComponents;
+
+            pixels[i]     = (unsigned char) (255 * clamp(color.r, 0.f, 1.f));	// red
+            pixels[i + 1] = (unsigned char) (255 * clamp(color.g, 0.f, 1.f));	// green
+            pixels[i + 2] = (unsigned char) (255 * clamp(color.b, 0.f, 1.f));	// blue
+        }
+
+    // Save the image to disk
+    int stride = 0;
+    if (!stbi_write_png(imageFileName.data(), m_width, m_height, numComponents, pixels.data(), stride))
+    {
+        cout << "STB failed to write image " << imageFileName << endl;
+        return false;
+    }
+    return true;
+}
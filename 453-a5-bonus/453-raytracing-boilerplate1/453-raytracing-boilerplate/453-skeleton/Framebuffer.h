@@ -0,0 +1,76 @@
+// ==========================================================================
+// CPU side image memory, split out of ImageBuffer
+//  - requires the OpenGL Mathmematics (GLM) library: http://glm.g-truc.net
+//  - requires the STB image write library: https://github.com/nothings/stb
+//
+// Holds the pixel colours of an image and remembers which rows have changed
+// since the last time somebody looked. It doesn't touch OpenGL, so the ray
+// tracer can render into one (and save it) on a machine without a display.
+// ImageBuffer puts one on the screen.
+// ==========================================================================
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <glm/vec3.hpp>
+
+class Framebuffer
+{
+    // dimensions of our image, and the pixel colour data array
+    int     m_width, m_height;
+    std::vector<glm::vec3> m_imageData;
+
+    // state variables to keep track of modified region
+    bool    m_modified;
+    int     m_modifiedLower, m_modifiedUpper;
+
+    // guards the pixel data and modified region against render threads
+    mutable std::mutex m_lock;
+
+    void ResetModified();
+
+public:
+    Framebuffer();
+
+    // returns the width or height of the currently allocated image
+    int Width() const  { return m_width; }
+    int Height() const { return m_height; }
+
+    // allocates a width x height image, filled with a grey checkerboard so
+    // that the parts that haven't been rendered yet stand out
+    void Resize(int width, int height);
+
+    // set a pixel in this image buffer to a specified colour:
+    //  - (0,0) is the bottom-left pixel of the image
+    //  - colour is RGB given as floating point numbers in the range [0,1]
+    void SetPixel(int x, int y, glm::vec3 colour);
+
+    // copy a width x height block of pixels, stored row by row, into the
+    // image with its bottom-left corner at (x,y). Safe to call from several
+    // threads at once.
+    void SetPixels(int x, int y, int width, int height, const glm::vec3 *colours);
+
+    // if any pixels changed since the last call, calls
+    // upload(lowerRow, upperRow, pixels of lowerRow) with the pixel data
+    // locked, so the rows [lowerRow, upperRow) can be copied somewhere
+    template <typename F>
+    void TakeModifiedRows(F &&upload)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_modified) return;
+        upload(m_modifiedLower, m_modifiedUpper, &m_imageData[m_modifiedLower * m_width]);
+        ResetModified();
+    }
+
+    // the whole image, row by row from the bottom. Don't call this while
+    // render threads are still writing to it.
+    const glm::vec3 *Data() const { return m_imageData.data(); }
+
+    // save the image to a PNG file
+    bool SaveToFile(const std::string &imageFileName) const;
+};
+
+// --------------------------------------------------------------------------
+#endif // FRAMEBUFFER_H
@@ -0,0 +1,39 @@
+//------------------------------------------------------------------------------
+// What every pixel's camera ray hit, kept from a render so the image can be
+// lit again without tracing the camera rays.
+//
+// Only the light and the materials may change in between: a relight still
+// traces the shadow, reflection and refraction rays, but against the old
+// camera hits. Moving the camera or any shape means rendering from scratch.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "RayTrace.h"
+
+struct GBuffer {
+	int width = 0;
+	int height = 0;
+	glm::vec3 viewPoint{ 0.0f };
+
+	// The hit of pixel (x, y) is hits[y * width + x]: position, normal, shape
+	// id and material index (into Scene::materials)
+	std::vector<Intersection> hits;
+
+	// Set once a render has filled in every pixel. Renders with more than one
+	// camera ray per pixel, or in wavefront mode, leave it unset.
+	bool valid = false;
+
+	void reset(int w, int h, glm::vec3 eye) {
+		width = w;
+		height = h;
+		viewPoint = eye;
+		hits.resize(w * h);
+		valid = false;
+	}
+
+	Intersection const &at(int x, int y) const { return hits[y * width + x]; }
+	Intersection &at(int x, int y) { return hits[y * width + x]; }
+};
@@ -8,19 +8,27 @@
 #include "Scene.h"
 #include "Material.h"
 
+// Only refers to the hit, ray and scene it shades, so setting one up for every
+// ray costs nothing: no copies of the scene's shape list, no heap allocations.
 struct PhongReflection {
+	PhongReflection(Intersection const &intersection, ObjectMaterial const &material, Ray const &ray, Scene const &scene)
+		: intersection(intersection)
+		, material(material)
+		, ray(ray)
+		, scene(scene)
+	{}
+
 	// Information about the point we're shading
-	Intersection intersection;
+	Intersection const &intersection;
 
 	// The point's material parameters
-	ObjectMaterial material;
+	ObjectMaterial const &material;
 
 	// Information about the ray being used.
-	Ray ray;
-
-	// Information about the scene
-	Scene scene;
+	Ray const &ray;
 
+	// Information about the scene (only the light is used)
+	Scene const &scene;
 
 	// Helper methods to name things the same as lecture
 	glm::vec3 l() const { return glm::normalize(scene.lightPosition - p()); } // light vector
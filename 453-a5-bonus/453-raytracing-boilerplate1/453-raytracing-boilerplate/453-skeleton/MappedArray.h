@@ -0,0 +1,49 @@
+//------------------------------------------------------------------------------
+// A read-only array that either owns its elements or looks at elements that
+// live somewhere else, in practice a memory mapped mesh file (see MeshFile.h).
+// Code that only reads from it doesn't need to know which.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class MappedArray {
+public:
+	MappedArray() = default;
+	MappedArray(MappedArray const &other) { *this = other; }
+	MappedArray &operator=(MappedArray const &other) {
+		owned = other.owned;
+		elements = other.isOwned() ? owned.data() : other.elements;
+		count = other.count;
+		return *this;
+	}
+
+	// Takes over the values
+	void assign(std::vector<T> values) {
+		owned = std::move(values);
+		elements = owned.data();
+		count = owned.size();
+	}
+
+	// Looks at `n` elements that someone else keeps alive
+	void view(T const *data, size_t n) {
+		owned.clear();
+		owned.shrink_to_fit();
+		elements = data;
+		count = n;
+	}
+
+	T const &operator[](size_t i) const { return elements[i]; }
+	T const *data() const { return elements; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	bool isOwned() const { return elements == owned.data() && !owned.empty(); }
+
+private:
+	std::vector<T> owned;
+	T const *elements = nullptr;
+	size_t count = 0;
+};
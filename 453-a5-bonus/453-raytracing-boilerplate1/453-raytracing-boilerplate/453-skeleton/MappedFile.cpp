@@ -0,0 +1,111 @@
+#include "MappedFile.h"
+
+#include "Log.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+std::shared_ptr<MappedFile> MappedFile::open(std::string const &path) {
+	std::shared_ptr<MappedFile> file(new MappedFile());
+	file->fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file->fileHandle == INVALID_HANDLE_VALUE) {
+		file->fileHandle = nullptr;
+		Log::error("Can't open {}", path);
+		return nullptr;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file->fileHandle, &size) || size.QuadPart == 0) {
+		Log::error("Can't map {}, it is empty", path);
+		return nullptr;
+	}
+	file->mappingHandle = CreateFileMappingA(file->fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	void *view = file->mappingHandle ? MapViewOfFile(file->mappingHandle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!view) {
+		Log::error("Can't map {}", path);
+		return nullptr;
+	}
+	file->bytes = static_cast<char const *>(view);
+	file->length = static_cast<size_t>(size.QuadPart);
+	return file;
+}
+
+MappedFile::~MappedFile() {
+	if (bytes) {
+		UnmapViewOfFile(bytes);
+	}
+	if (mappingHandle) {
+		CloseHandle(mappingHandle);
+	}
+	if (fileHandle) {
+		CloseHandle(fileHandle);
+	}
+}
+
+void MappedFile::release(size_t offset, size_t count) const {
+	// Unlocking pages that aren't locked takes them out of the working set
+	VirtualUnlock(const_cast<char *>(bytes) + offset, count);
+}
+
+size_t MappedFile::pageSize() {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+}
+
+#else
+
+std::shared_ptr<MappedFile> MappedFile::open(std::string const &path) {
+	std::shared_ptr<MappedFile> file(new MappedFile());
+	file->fd = ::open(path.c_str(), O_RDONLY);
+	if (file->fd < 0) {
+		Log::error("Can't open {}", path);
+		return nullptr;
+	}
+	struct stat status;
+	if (fstat(file->fd, &status) != 0 || status.st_size == 0) {
+		Log::error("Can't map {}, it is empty", path);
+		return nullptr;
+	}
+	void *view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, file->fd, 0);
+	if (view == MAP_FAILED) {
+		Log::error("Can't map {}", path);
+		return nullptr;
+	}
+	file->bytes = static_cast<char const *>(view);
+	file->length = static_cast<size_t>(status.st_size);
+	return file;
+}
+
+MappedFile::~MappedFile() {
+	if (bytes) {
+		munmap(const_cast<char *>(bytes), length);
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+void MappedFile::release(size_t offset, size_t count) const {
+	// Out of our address space, and out of the page cache as well, so the
+	// memory really is free for something else
+	madvise(const_cast<char *>(bytes) + offset, count, MADV_DONTNEED);
+#ifdef POSIX_FADV_DONTNEED
+	posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(count), POSIX_FADV_DONTNEED);
+#endif
+}
+
+size_t MappedFile::pageSize() {
+	return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+#endif
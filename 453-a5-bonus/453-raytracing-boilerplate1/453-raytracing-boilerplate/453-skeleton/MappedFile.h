@@ -0,0 +1,42 @@
+//------------------------------------------------------------------------------
+// A file mapped read-only into memory. Its pages are only read from disk when
+// they are first touched, and can be handed back to the OS again (release),
+// which reads them back in if they are ever touched after that.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+class MappedFile {
+public:
+	// Maps the whole file. Returns nullptr (and logs why) if it can't.
+	static std::shared_ptr<MappedFile> open(std::string const &path);
+
+	~MappedFile();
+	MappedFile(MappedFile const &) = delete;
+	MappedFile &operator=(MappedFile const &) = delete;
+
+	char const *data() const { return bytes; }
+	size_t size() const { return length; }
+
+	// Lets the OS drop [offset, offset + count) from memory. offset has to
+	// be a multiple of pageSize().
+	void release(size_t offset, size_t count) const;
+
+	// Size of the OS's memory pages
+	static size_t pageSize();
+
+private:
+	MappedFile() = default;
+
+	char const *bytes = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	void *fileHandle = nullptr;
+	void *mappingHandle = nullptr;
+#else
+	int fd = -1;
+#endif
+};
@@ -0,0 +1,173 @@
+#include "MeshFile.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include "Log.h"
+#include "MappedFile.h"
+#include "PageBudget.h"
+
+namespace {
+
+uint64_t alignUp(uint64_t offset) {
+	return (offset + PAGE_BUDGET_BLOCK_SIZE - 1) / PAGE_BUDGET_BLOCK_SIZE * PAGE_BUDGET_BLOCK_SIZE;
+}
+
+void storeBounds(AABB const &box, float *out) {
+	for (int axis = 0; axis < 3; axis++) {
+		out[axis] = box.min[axis];
+		out[3 + axis] = box.max[axis];
+	}
+}
+
+AABB loadBounds(float const *in) {
+	return AABB(glm::vec3(in[0], in[1], in[2]), glm::vec3(in[3], in[4], in[5]));
+}
+
+} // namespace
+
+bool writeMeshFile(Triangles const &mesh, std::string const &path) {
+	TriangleSoA const &soa = mesh.soa;
+	uint64_t arrayBytes = uint64_t(soa.count + TriangleSoA::PADDING) * sizeof(float);
+
+	MeshFileHeader header = {};
+	std::memcpy(header.magic, MESH_FILE_MAGIC, sizeof(header.magic));
+	header.version = MESH_FILE_VERSION;
+	header.nodeSize = sizeof(WideBVHNode);
+	header.triangleCount = soa.count;
+	header.nodeCount = static_cast<int32_t>(mesh.bvh.nodes.size());
+	storeBounds(mesh.box, header.bounds);
+	storeBounds(mesh.bvh.bounds(), header.bvhBounds);
+	header.soaOffset = alignUp(sizeof(MeshFileHeader));
+	header.soaStride = alignUp(arrayBytes);
+	header.nodesOffset = header.soaOffset + TriangleSoA::ARRAYS * header.soaStride;
+	header.fileSize = header.nodesOffset + uint64_t(header.nodeCount) * sizeof(WideBVHNode);
+
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	uint64_t written = 0;
+	auto write = [&](void const *data, uint64_t size) {
+		out.write(static_cast<char const *>(data), static_cast<std::streamsize>(size));
+		written += size;
+	};
+	auto padTo = [&](uint64_t offset) {
+		const char zeros[4096] = {};
+		while (written < offset) {
+			write(zeros, std::min<uint64_t>(sizeof(zeros), offset - written));
+		}
+	};
+
+	write(&header, sizeof(header));
+	MappedArray<float> const *arrays[] = { &soa.v0x, &soa.v0y, &soa.v0z, &soa.e1x, &soa.e1y, &soa.e1z, &soa.e2x, &soa.e2y, &soa.e2z };
+	for (int k = 0; k < TriangleSoA::ARRAYS; k++) {
+		padTo(header.soaOffset + k * header.soaStride);
+		write(arrays[k]->data(), arrayBytes);
+	}
+	padTo(header.nodesOffset);
+	write(mesh.bvh.nodes.data(), uint64_t(header.nodeCount) * sizeof(WideBVHNode));
+
+	out.close();
+	if (!out) {
+		Log::error("Can't write the mesh file {}", path);
+		return false;
+	}
+	return true;
+}
+
+std::shared_ptr<Triangles> openMeshFile(std::string const &path, size_t budgetBytes, int id) {
+	std::shared_ptr<MappedFile> file = MappedFile::open(path);
+	if (!file) {
+		return nullptr;
+	}
+
+	MeshFileHeader header;
+	if (file->size() < sizeof(header)) {
+		Log::error("{} is not a mesh file", path);
+		return nullptr;
+	}
+	std::memcpy(&header, file->data(), sizeof(header));
+	if (std::memcmp(header.magic, MESH_FILE_MAGIC, sizeof(header.magic)) != 0) {
+		Log::error("{} is not a mesh file", path);
+		return nullptr;
+	}
+	if (header.version != MESH_FILE_VERSION || header.nodeSize != sizeof(WideBVHNode)) {
+		Log::error("{} was written by another version of the ray tracer, convert the mesh again", path);
+		return nullptr;
+	}
+	uint64_t arrayBytes = uint64_t(header.triangleCount + TriangleSoA::PADDING) * sizeof(float);
+	bool aligned = header.soaOffset % PAGE_BUDGET_BLOCK_SIZE == 0 && header.soaStride % PAGE_BUDGET_BLOCK_SIZE == 0 && header.nodesOffset % PAGE_BUDGET_BLOCK_SIZE == 0;
+	if (header.triangleCount < 0 || header.nodeCount < 0 || !aligned || header.soaStride < arrayBytes
+		|| header.nodesOffset < header.soaOffset + TriangleSoA::ARRAYS * header.soaStride
+		|| header.fileSize != header.nodesOffset + uint64_t(header.nodeCount) * sizeof(WideBVHNode)
+		|| header.fileSize != file->size()) {
+		Log::error("{} is damaged or cut short", path);
+		return nullptr;
+	}
+
+	auto mesh = std::make_shared<Triangles>();
+	mesh->id = id;
+	mesh->box = loadBounds(header.bounds);
+	mesh->pages = std::make_shared<PageBudget>(file, budgetBytes);
+	mesh->soa.view(mesh->pages.get(), header.soaOffset, header.soaStride, header.triangleCount);
+	mesh->bvh.view(mesh->pages.get(), header.nodesOffset, header.nodeCount, loadBounds(header.bvhBounds));
+	return mesh;
+}
+
+bool readObj(std::string const &path, std::vector<glm::vec3> &corners) {
+	std::ifstream in(path);
+	if (!in) {
+		Log::error("Can't open {}", path);
+		return false;
+	}
+
+	std::vector<glm::vec3> vertices;
+	std::vector<int> face;
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(in, line)) {
+		lineNumber++;
+		char const *p = line.c_str();
+		if (p[0] == 'v' && p[1] == ' ') {
+			char *end;
+			glm::vec3 v;
+			p += 2;
+			for (int axis = 0; axis < 3; axis++) {
+				v[axis] = std::strtof(p, &end);
+				if (end == p) {
+					Log::error("{}:{}: a vertex needs three coordinates", path, lineNumber);
+					return false;
+				}
+				p = end;
+			}
+			vertices.push_back(v);
+		} else if (p[0] == 'f' && p[1] == ' ') {
+			// Corners are v, v/vt, v//vn or v/vt/vn; negative v counts back from the last vertex
+			face.clear();
+			p += 2;
+			while (true) {
+				char *end;
+				long index = std::strtol(p, &end, 10);
+				if (end == p) {
+					break;
+				}
+				index = index < 0 ? long(vertices.size()) + index : index - 1;
+				if (index < 0 || index >= long(vertices.size())) {
+					Log::error("{}:{}: the face refers to a vertex that isn't there", path, lineNumber);
+					return false;
+				}
+				face.push_back(static_cast<int>(index));
+				p = end;
+				while (*p != '\0' && *p != ' ' && *p != '\t') {
+					p++;
+				}
+			}
+			for (size_t i = 2; i < face.size(); i++) {
+				corners.push_back(vertices[face[0]]);
+				corners.push_back(vertices[face[i - 1]]);
+				corners.push_back(vertices[face[i]]);
+			}
+		}
+	}
+	return true;
+}
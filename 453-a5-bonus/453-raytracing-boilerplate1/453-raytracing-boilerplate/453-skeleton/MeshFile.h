@@ -0,0 +1,60 @@
+//------------------------------------------------------------------------------
+// Triangle meshes on disk.
+//
+// A mesh file holds a Triangles mesh the way the ray tracer uses it: the
+// triangles in BVH leaf order (TriangleSoA) and the 4 wide BVH over them,
+// each in blocks aligned to PAGE_BUDGET_BLOCK_SIZE. openMeshFile maps the
+// file and points the mesh straight at it, so opening one takes no time no
+// matter how big it is, and only the parts rays actually reach are ever read
+// from disk. A PageBudget keeps the memory that takes below a limit, so a
+// mesh can be bigger than the machine's memory.
+//
+// Layout (native byte order, and the WideBVHNode layout of the build that
+// wrote it; files from other builds are refused):
+//
+//   MeshFileHeader
+//   TriangleSoA arrays v0x .. e2z, each triangleCount + PADDING floats,
+//       array k at soaOffset + k * soaStride
+//   WideBVH nodes, nodeCount of them at nodesOffset
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "RayTrace.h"
+
+const char MESH_FILE_MAGIC[8] = { 'R', 'T', '4', '5', '3', 'M', 'S', 'H' };
+const uint32_t MESH_FILE_VERSION = 1;
+
+struct MeshFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t nodeSize;     // sizeof(WideBVHNode)
+	int32_t triangleCount;
+	int32_t nodeCount;
+	float bounds[6];       // Triangles::box, min then max
+	float bvhBounds[6];    // WideBVH::bounds()
+	uint64_t soaOffset;
+	uint64_t soaStride;
+	uint64_t nodesOffset;
+	uint64_t fileSize;
+};
+
+// Writes the mesh (one built by initTriangles, or opened from another mesh
+// file) to path. Returns false (and logs why) if it can't.
+bool writeMeshFile(Triangles const &mesh, std::string const &path);
+
+// Maps the mesh file at path, keeping at most budgetBytes of it in memory
+// (0 for no limit). The mesh gets the given id and a default material.
+// Returns nullptr (and logs why) if the file can't be opened or isn't a
+// mesh file.
+std::shared_ptr<Triangles> openMeshFile(std::string const &path, size_t budgetBytes, int id);
+
+// Reads the triangles of a Wavefront OBJ file: three corners per triangle,
+// ready for Triangles::initTriangles. Only vertex positions and faces are
+// used; faces with more than three corners are split into a fan.
+bool readObj(std::string const &path, std::vector<glm::vec3> &corners);
@@ -0,0 +1,64 @@
+//------------------------------------------------------------------------------
+// Space filling curves. Points that are close together in space mostly end up
+// close together when sorted by where they are on the curve.
+//
+// Morton (Z-order) codes are just the bits of the coordinates interleaved.
+// The Hilbert curve is a bit more work, but never jumps: every point on it is
+// next to the one before.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+
+// Spreads the low 10 bits of v out to every third bit
+inline uint32_t spreadBits3(uint32_t v) {
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+// Spreads the low 16 bits of v out to every other bit
+inline uint32_t spreadBits2(uint32_t v) {
+	v &= 0xffff;
+	v = (v | (v << 8)) & 0x00ff00ff;
+	v = (v | (v << 4)) & 0x0f0f0f0f;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+// 30 bit code of a point on a 1024^3 grid
+inline uint32_t mortonCode3(uint32_t x, uint32_t y, uint32_t z) {
+	return (spreadBits3(x) << 2) | (spreadBits3(y) << 1) | spreadBits3(z);
+}
+
+// 32 bit code of a point on a 65536^2 grid
+inline uint32_t mortonCode2(uint32_t x, uint32_t y) {
+	return (spreadBits2(y) << 1) | spreadBits2(x);
+}
+
+// Distance along the Hilbert curve through an n x n grid (n a power of 2) to
+// the cell (x, y)
+inline uint32_t hilbertIndex2(uint32_t n, uint32_t x, uint32_t y) {
+	uint32_t d = 0;
+	for (uint32_t s = n / 2; s > 0; s /= 2) {
+		uint32_t rx = (x & s) > 0;
+		uint32_t ry = (y & s) > 0;
+		d += s * s * ((3 * rx) ^ ry);
+
+		// Turn the quadrant around so the curve inside it lines up
+		if (ry == 0) {
+			if (rx == 1) {
+				x = n - 1 - x;
+				y = n - 1 - y;
+			}
+			uint32_t t = x;
+			x = y;
+			y = t;
+		}
+	}
+	return d;
+}
@@ -0,0 +1,46 @@
+#include "PageBudget.h"
+
+#include <algorithm>
+
+PageBudget::PageBudget(std::shared_ptr<MappedFile const> file, size_t budgetBytes)
+	: mapped(std::move(file))
+	, blockCount((mapped->size() + PAGE_BUDGET_BLOCK_SIZE - 1) / PAGE_BUDGET_BLOCK_SIZE)
+	, budgetBlocks(budgetBytes == 0 ? 0 : std::max<size_t>(1, budgetBytes / PAGE_BUDGET_BLOCK_SIZE))
+	, lastUse(std::make_unique<std::atomic<uint32_t>[]>(blockCount))
+{
+	candidates.reserve(blockCount);
+}
+
+void PageBudget::admit(size_t block) {
+	std::lock_guard<std::mutex> lock(admitting);
+	if (lastUse[block].load(std::memory_order_relaxed) != 0) {
+		return; // another thread got here first
+	}
+	lastUse[block].store(clock.fetch_add(1) + 1, std::memory_order_relaxed);
+	size_t count = resident.fetch_add(1) + 1;
+	if (budgetBlocks == 0 || count <= budgetBlocks) {
+		return;
+	}
+
+	// Over budget. Hand back the blocks that went unused the longest, enough
+	// to get an eighth below the budget, so this doesn't happen again for
+	// every new block.
+	candidates.clear();
+	for (size_t b = 0; b < blockCount; b++) {
+		uint32_t stamp = lastUse[b].load(std::memory_order_relaxed);
+		if (stamp != 0 && b != block) {
+			candidates.push_back({ stamp, b });
+		}
+	}
+	size_t target = budgetBlocks - budgetBlocks / 8;
+	size_t drop = std::min(count - std::min(count, target), candidates.size());
+	std::nth_element(candidates.begin(), candidates.begin() + drop, candidates.end());
+	for (size_t i = 0; i < drop; i++) {
+		size_t b = candidates[i].second;
+		lastUse[b].store(0, std::memory_order_relaxed);
+		size_t offset = b * PAGE_BUDGET_BLOCK_SIZE;
+		mapped->release(offset, std::min(PAGE_BUDGET_BLOCK_SIZE, mapped->size() - offset));
+	}
+	resident.fetch_sub(drop);
+	evicted.fetch_add(drop);
+}
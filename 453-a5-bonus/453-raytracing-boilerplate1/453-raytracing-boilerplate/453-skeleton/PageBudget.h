@@ -0,0 +1,80 @@
+//------------------------------------------------------------------------------
+// Keeps the parts of a mapped file that are in use in memory, up to a budget.
+//
+// The file is split into blocks of PAGE_BUDGET_BLOCK_SIZE bytes. Whoever
+// reads from the file reports what it reads with touch(), and every block
+// remembers when it was last touched. Once more blocks have been touched than
+// the budget allows, the ones that went unused the longest are handed back to
+// the OS (see MappedFile::release). Touching one of those again just reads it
+// back in from disk.
+//
+// touch() is called by every thread tracing rays, for every BVH node and
+// leaf they visit, so it only reads the block's time stamp unless the block
+// is new or its stamp is out of date. Handing blocks back takes a lock, but
+// only happens when a block is touched for the first time. Blocks only ever
+// go from not in memory (a stamp of 0) to in memory under that lock, so
+// `resident` counts each of them once.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "MappedFile.h"
+
+// 16 pages of 4 KB, the unit the budget is counted and released in
+const size_t PAGE_BUDGET_BLOCK_SIZE = 64 * 1024;
+
+class PageBudget {
+public:
+	// budgetBytes = 0 keeps every block that was ever touched
+	PageBudget(std::shared_ptr<MappedFile const> file, size_t budgetBytes);
+
+	MappedFile const &file() const { return *mapped; }
+
+	void touch(size_t offset, size_t count) {
+		size_t last = (offset + count - 1) / PAGE_BUDGET_BLOCK_SIZE;
+		for (size_t block = offset / PAGE_BUDGET_BLOCK_SIZE; block <= last; block++) {
+			uint32_t seen = lastUse[block].load(std::memory_order_relaxed);
+			if (seen != 0) {
+				uint32_t now = clock.load(std::memory_order_relaxed);
+				if (seen == now) {
+					continue;
+				}
+				// Only if the stamp is still the one we read: if the block was
+				// handed back in the meantime, its 0 has to stay, so that it is
+				// admitted (and counted) again
+				if (lastUse[block].compare_exchange_strong(seen, now, std::memory_order_relaxed) || seen != 0) {
+					continue;
+				}
+			}
+			admit(block);
+		}
+	}
+
+	size_t residentBytes() const { return resident.load() * PAGE_BUDGET_BLOCK_SIZE; }
+	size_t budgetBytes() const { return budgetBlocks * PAGE_BUDGET_BLOCK_SIZE; }
+	// Number of blocks handed back to the OS so far
+	size_t evictions() const { return evicted.load(); }
+
+private:
+	std::shared_ptr<MappedFile const> mapped;
+	size_t blockCount;
+	size_t budgetBlocks; // 0: no budget
+
+	// When each block was last touched, in ticks of `clock`; 0 if it isn't in memory
+	std::unique_ptr<std::atomic<uint32_t>[]> lastUse;
+	// Goes up by one whenever a block is brought in
+	std::atomic<uint32_t> clock{ 1 };
+	std::atomic<size_t> resident{ 0 };
+	std::atomic<size_t> evicted{ 0 };
+	std::mutex admitting;
+	std::vector<std::pair<uint32_t, size_t>> candidates; // for admit, so it doesn't allocate while tracing
+
+	// A block was touched that isn't counted as in memory yet
+	void admit(size_t block);
+};
@@ -0,0 +1,26 @@
+//------------------------------------------------------------------------------
+// Splitting a loop over a few threads, for the BVH and grid builders.
+//
+// This doesn't go through TileScheduler: builds don't have one to hand, and
+// the BVH builder splits work again inside work that is already split, which
+// a scheduler that runs one job at a time can't do.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <thread>
+#include <vector>
+
+// Splits [begin, end) into `chunks` pieces and calls fn(chunk, chunkBegin, chunkEnd)
+// for each of them on its own thread. The calling thread does chunk 0.
+template <typename F>
+void parallelChunks(int begin, int end, int chunks, F &&fn) {
+	std::vector<std::thread> threads;
+	auto chunkStart = [&](int c) { return begin + static_cast<int>(static_cast<long long>(end - begin) * c / chunks); };
+	for (int c = 1; c < chunks; c++) {
+		threads.emplace_back([&, c] { fn(c, chunkStart(c), chunkStart(c + 1)); });
+	}
+	fn(0, chunkStart(0), chunkStart(1));
+	for (auto &t : threads) {
+		t.join();
+	}
+}
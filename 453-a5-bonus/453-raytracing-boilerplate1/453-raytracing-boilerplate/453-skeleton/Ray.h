@@ -0,0 +1,64 @@
+//------------------------------------------------------------------------------
+// Rays and the axis aligned boxes used to bound shapes.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <limits>
+#include <glm/glm.hpp>
+
+struct Ray {
+	glm::vec3 origin;
+	glm::vec3 direction;
+
+	Ray(glm::vec3 point, glm::vec3 dir){
+		origin = point;
+		direction = dir;
+	}
+	Ray(): origin(glm::vec3(0,0,0)), direction(glm::vec3(0,0,0))
+	{}
+};
+
+// Occlusion queries ignore hits this close to the ray origin (in units of t),
+// so a shadow ray isn't blocked by the surface it leaves from.
+const float OCCLUSION_T_MIN = 0.00001f;
+
+// Axis aligned bounding box. A default constructed box is empty.
+struct AABB {
+	glm::vec3 min;
+	glm::vec3 max;
+
+	AABB()
+		: min(std::numeric_limits<float>::max())
+		, max(-std::numeric_limits<float>::max())
+	{}
+	AABB(glm::vec3 lo, glm::vec3 hi): min(lo), max(hi)
+	{}
+
+	void extend(glm::vec3 p) {
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+	void extend(AABB const &b) {
+		min = glm::min(min, b.min);
+		max = glm::max(max, b.max);
+	}
+
+	glm::vec3 centre() const { return 0.5f * (min + max); }
+	glm::vec3 extent() const { return max - min; }
+	float surfaceArea() const {
+		glm::vec3 e = glm::max(extent(), glm::vec3(0.0f));
+		return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+
+	// Slab test against a ray with precomputed 1/direction. On a hit within
+	// [0, tMax], tNear is set to where the ray enters the box.
+	bool intersect(glm::vec3 origin, glm::vec3 invDir, float tMax, float &tNear) const {
+		glm::vec3 t0 = (min - origin) * invDir;
+		glm::vec3 t1 = (max - origin) * invDir;
+		glm::vec3 tSmall = glm::min(t0, t1);
+		glm::vec3 tBig = glm::max(t0, t1);
+		tNear = glm::max(glm::max(tSmall.x, tSmall.y), glm::max(tSmall.z, 0.0f));
+		float tFar = glm::min(glm::min(tBig.x, tBig.y), glm::min(tBig.z, tMax));
+		return tNear <= tFar;
+	}
+};
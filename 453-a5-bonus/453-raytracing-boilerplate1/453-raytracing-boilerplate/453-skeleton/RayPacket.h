@@ -0,0 +1,65 @@
+//------------------------------------------------------------------------------
+// A bundle of rays that are traced through the BVHs together.
+//
+// Camera rays for neighbouring pixels point in almost the same direction, so
+// they visit almost the same BVH nodes. Tracing a 4x4 block of them at once
+// means each node is fetched and tested once for all 16 rays, and the box test
+// runs over the lanes in a loop the compiler can vectorise.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <glm/glm.hpp>
+
+#include "Ray.h"
+
+struct RayPacket {
+	static const int SIZE = 16; // 4x4 pixels
+	static const int WIDTH = 4;
+
+	// One array per component so the lane loops are easy to vectorise
+	float ox[SIZE], oy[SIZE], oz[SIZE];
+	float dx[SIZE], dy[SIZE], dz[SIZE];
+	float invDx[SIZE], invDy[SIZE], invDz[SIZE];
+
+	void set(int lane, Ray const &ray) {
+		ox[lane] = ray.origin.x; oy[lane] = ray.origin.y; oz[lane] = ray.origin.z;
+		dx[lane] = ray.direction.x; dy[lane] = ray.direction.y; dz[lane] = ray.direction.z;
+		invDx[lane] = 1.0f / ray.direction.x;
+		invDy[lane] = 1.0f / ray.direction.y;
+		invDz[lane] = 1.0f / ray.direction.z;
+	}
+
+	Ray ray(int lane) const {
+		return Ray(glm::vec3(ox[lane], oy[lane], oz[lane]), glm::vec3(dx[lane], dy[lane], dz[lane]));
+	}
+
+	// Slab test of every lane against the box. Returns the lanes of `active` that
+	// hit it before their own tMax, and the smallest entry distance among them.
+	uint32_t intersect(AABB const &box, uint32_t active, float const *tMax, float &tNearest) const {
+		uint32_t hits = 0;
+		tNearest = std::numeric_limits<float>::max();
+		for (int i = 0; i < SIZE; i++) {
+			float t0x = (box.min.x - ox[i]) * invDx[i], t1x = (box.max.x - ox[i]) * invDx[i];
+			float t0y = (box.min.y - oy[i]) * invDy[i], t1y = (box.max.y - oy[i]) * invDy[i];
+			float t0z = (box.min.z - oz[i]) * invDz[i], t1z = (box.max.z - oz[i]) * invDz[i];
+			float tNear = glm::max(glm::max(glm::min(t0x, t1x), glm::min(t0y, t1y)), glm::max(glm::min(t0z, t1z), 0.0f));
+			float tFar = glm::min(glm::min(glm::max(t0x, t1x), glm::max(t0y, t1y)), glm::min(glm::max(t0z, t1z), tMax[i]));
+			bool hit = tNear <= tFar && ((active >> i) & 1u);
+			hits |= static_cast<uint32_t>(hit) << i;
+			tNearest = hit ? glm::min(tNearest, tNear) : tNearest;
+		}
+		return hits;
+	}
+};
+
+// Calls fn(lane) for every set bit of mask
+template <typename F>
+void forEachLane(uint32_t mask, F &&fn) {
+	for (int lane = 0; lane < RayPacket::SIZE; lane++) {
+		if ((mask >> lane) & 1u) {
+			fn(lane);
+		}
+	}
+}
@@ -3,77 +3,69 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "RayTrace.h"
+#include "ShapeBuckets.h"
 
 
 using namespace std;
 using namespace glm;
 
+uint32_t Shape::intersectPacket(RayPacket const &packet, uint32_t active, Hit *hits) const {
+	uint32_t closer = 0;
+	forEachLane(active, [&](int lane) {
+		if (intersect(packet.ray(lane), hits[lane])) {
+			closer |= 1u << lane;
+		}
+	});
+	return closer;
+}
+
 Sphere::Sphere(vec3 c, float r, int ID){
 	centre = c;
 	radius = r;
 	id = ID;
 }
 
+AABB Sphere::bounds() const {
+	return AABB(centre - vec3(radius), centre + vec3(radius));
+}
+
 //------------------------------------------------------------------------------
 // This is part 2.1 of your assignment. At the moment, the spheres are not showing
 // up. Implement this method to make them show up.
 //
-// Make sure you set all of the appropriate fields in the Intersection object.
+// Make sure you set all of the appropriate fields in the Hit object.
 //------------------------------------------------------------------------------
-Intersection Sphere::getIntersection(Ray ray){
-	Intersection i{};
-	i.id = id;
-	i.material = material;
-
-	vec3 oc = ray.origin - centre;
-
-	float a = dot(ray.direction, ray.direction);
-	float b = 2.0f * dot(oc, ray.direction);
-	float c = dot(oc, oc) - radius * radius;
-	float discriminant = b * b - 4 * a * c;
-
+bool Sphere::intersect(Ray const &ray, Hit &hit) const {
+	// The ray test itself is intersectSlot in ShapeBuckets.h, shared with the
+	// renderer's loops over all the spheres of a scene.
+	//
+	// NOTE: a hit only records where along the ray it is (hit.t), and only if
+	// it is closer than the hit that's already there. The normal is worked
+	// out by normalAt(), once we know which hit is the closest.
+	return intersectSlot(slot(-1), ray, hit);
+}
 
-	if (discriminant < 0) {
-		i.numberOfIntersections = 0;
-		return i;
-	}
-	//intersection points
-	float t1 = (-b - sqrt(discriminant)) / (2.0f * a);
-	float t2 = (-b + sqrt(discriminant)) / (2.0f * a);
+vec3 Sphere::normalAt(Ray const &ray, Hit const &hit) const {
+	return normalize(ray.origin + hit.t * ray.direction - centre);
+}
 
-	float t = (t1 > 0) ? t1 : t2;
+bool Sphere::occluded(Ray const &ray, float tMax) const {
+	return occludedSlot(slot(-1), ray, tMax);
+}
 
-	if (t <= 0) {
-		i.numberOfIntersections = 0;
-		return i;
-	}
-	i.point = ray.origin + t * ray.direction;
-	i.normal = normalize(i.point - centre);
-	i.numberOfIntersections = 1;
+SphereSlot Sphere::slot(int shapeIndex) const {
+	return { centre, radius, shapeIndex, id };
+}
 
-	// You are required to implement this intersection.
-	//
-	// NOTE: You _must_ set these values appropriately for each case:
-	//
-	// No Intersection:
-	// i.numberOfIntersections = 0;
-	//
-	// Intersection:
-	// i.normal = **the normal at the point of intersection **
-	// i.point = **the point of intersection**
-	// i.numberOfIntersections = 1; // for a single intersection
-	//
-	// If you get fancy and implement things like refraction, you may actually
-	// want to track more than one intersection. You'll need to change
-	// The intersection struct in that case.
-	return i;
+void Sphere::addTo(ShapeBuckets &buckets, int shapeIndex) const {
+	buckets.spheres.add(slot(shapeIndex), bounds());
 }
 
 //------------------------------------------------------------------------------
 // This is part 2.2 of your assignment. At the moment, the cylinders are not showing
 // up. Implement this method to make them show up.
 //
-// Make sure you set all of the appropriate fields in the Intersection object.
+// Make sure you set all of the appropriate fields in the Hit object.
 //------------------------------------------------------------------------------
 Cylinder::Cylinder(vec3 c, float r, int ID, float h, mat3 rot)
 {
@@ -85,86 +77,49 @@ Cylinder::Cylinder(vec3 c, float r, int ID, float h, mat3 rot)
 	orientationInv = glm::transpose(rot);
 }
 
-Intersection Cylinder::getIntersection(Ray ray)
-{
-	Intersection i{};
-	i.id = id;
-	i.material = material;
-
-
-	// You are required to implement this intersection.
-	//
-	// NOTE: You _must_ set these values appropriately for each case:
-	//
-	// No Intersection:
-	// i.numberOfIntersections = 0;
-	//
-	// Intersection:
-	// i.normal = **the normal at the point of intersection **
-	// i.point = **the point of intersection**
-	// i.numberOfIntersections = 1; // for a single intersection
-	//
-	// If you get fancy and implement things like refraction, you may actually
-	// want to track more than one intersection. You'll need to change
-	// The intersection struct in that case.
-
-	vec3 localOrigin = orientationInv * (ray.origin - center);
-	vec3 localDir = orientationInv * ray.direction;
-	float dx = localDir.x;
-	float dz = localDir.z;
-	float ox = localOrigin.x;
-	float oz = localOrigin.z;
-	float A = dx * dx + dz * dz;
-
-	//ray is parallel to cylinder's axis or no valid intersection
-	if (A < 1e-8) {
-		i.numberOfIntersections = 0;
-		return i;
-	}
-	float B = 2.0f * (dx * ox + dz * oz);
-	float C = ox * ox + oz * oz - radius * radius;
-	float discriminant = B * B - 4 * A * C;
-	if (discriminant < 0) {
-		i.numberOfIntersections = 0;
-		return i;
+AABB Cylinder::bounds() const {
+	// Bound the cylinder in its local space and take the world space box
+	// around that box's rotated corners.
+	float halfHeight = height * 0.5f;
+	AABB box;
+	for (int corner = 0; corner < 8; corner++) {
+		vec3 local(
+			(corner & 1) ? radius : -radius,
+			(corner & 2) ? halfHeight : -halfHeight,
+			(corner & 4) ? radius : -radius
+		);
+		box.extend(center + orientation * local);
 	}
+	return box;
+}
 
-	float t1 = (-B - sqrt(discriminant)) / (2.0f * A);
-	float t2 = (-B + sqrt(discriminant)) / (2.0f * A);
-
-	float  t = (t1 > 0) ? t1 : t2;
+bool Cylinder::intersect(Ray const &ray, Hit &hit) const
+{
+	// The ray test itself is intersectSlot in ShapeBuckets.h, shared with the
+	// renderer's loops over all the cylinders of a scene.
+	//
+	// NOTE: a hit only records where along the ray it is (hit.t), and only if
+	// it is closer than the hit that's already there. The normal is worked
+	// out by normalAt(), once we know which hit is the closest.
+	return intersectSlot(slot(-1), ray, hit);
+}
 
-	//check if intersection point within height bounds
-	vec3 localP = localOrigin + t * localDir; //intersection in local space
-	float halfHeight = height * 0.5f;
+vec3 Cylinder::normalAt(Ray const &ray, Hit const &hit) const {
+	vec3 localP = orientationInv * (ray.origin + hit.t * ray.direction - center);
+	vec3 localN = normalize(vec3(localP.x, 0.0f, localP.z)); //normal in local space
+	return glm::normalize(orientation * localN); //back to world space
+}
 
+bool Cylinder::occluded(Ray const &ray, float tMax) const {
+	return occludedSlot(slot(-1), ray, tMax);
+}
 
-	if (localP.y < -halfHeight || localP.y > halfHeight) { //intersection out of range, try other t
-		if (t == t1) {
-			t = t2;
-			if (t <= 0) {
-				i.numberOfIntersections = 0;
-				return i;
-			}
-			localP = localOrigin + t * localDir;
-			if (localP.y < -halfHeight || localP.y > halfHeight) {
-				i.numberOfIntersections = 0;
-				return i;
-			}
-		}
-		else {
-			i.numberOfIntersections = 0;
-			return i;
-		}
-	}
+CylinderSlot Cylinder::slot(int shapeIndex) const {
+	return { center, radius, height * 0.5f, orientationInv, shapeIndex, id };
+}
 
-	//valid intersection
-	i.point = ray.origin + t * ray.direction;
-	vec3 localN = normalize(vec3(localP.x, 0.0f, localP.z)); //normal in local space
-	vec3 worldN = glm::normalize(orientation * localN); //back to world space
-	i.normal = worldN;
-	i.numberOfIntersections = 1;
-	return i;
+void Cylinder::addTo(ShapeBuckets &buckets, int shapeIndex) const {
+	buckets.cylinders.add(slot(shapeIndex), bounds());
 }
 
 Plane::Plane(vec3 p, vec3 n, int ID){
@@ -173,6 +128,11 @@ Plane::Plane(vec3 p, vec3 n, int ID){
 	id = ID;
 }
 
+AABB Plane::bounds() const {
+	float inf = std::numeric_limits<float>::infinity();
+	return AABB(vec3(-inf), vec3(inf));
+}
+
 
 float dot_normalized(vec3 v1, vec3 v2){
 	return glm::dot(glm::normalize(v1), glm::normalize(v2));
@@ -184,86 +144,172 @@ void debug(char* str, vec3 a){
 // --------------------------------------------------------------------------
 void Triangles::initTriangles(int num, vec3 * t, int ID){
 	id = ID;
-	for(int i = 0; i< num; i++){
-		triangles.push_back(Triangle(*t, *(t+1), *(t+2)));
-		t+=3;
+	// The triangles are only kept in soa, read straight from t
+	std::vector<AABB> triangleBounds;
+	triangleBounds.reserve(num);
+	box = AABB();
+	for (int i = 0; i < num; i++) {
+		AABB triangleBox;
+		triangleBox.extend(t[3 * i]);
+		triangleBox.extend(t[3 * i + 1]);
+		triangleBox.extend(t[3 * i + 2]);
+		triangleBounds.push_back(triangleBox);
+		box.extend(triangleBox);
 	}
+	// Leaves of up to 8 triangles fill one AVX2 kernel call. The binary BVH
+	// is only needed until it has been collapsed into the wide one.
+	BVH binary;
+	binary.build(triangleBounds, 8, 8);
+	soa.build(t, binary.primitives);
+	bvh.build(binary);
+}
+
+void Triangles::addTo(ShapeBuckets &buckets, int shapeIndex) const {
+	buckets.meshes.add({ this, shapeIndex, id }, bounds());
+}
+
+AABB Triangles::bounds() const {
+	return box;
 }
 
-Intersection Triangles::intersectTriangle(Ray ray, Triangle triangle){
-	// From https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
-	const float EPSILON = 0.0000001;
-	auto vertex0 = triangle.p1;
-	auto vertex1 = triangle.p2;
-	auto vertex2 = triangle.p3;
-
-	glm::vec3 edge1, edge2, h, s, q;
-	float a,f,u,v;
-	edge1 = vertex1 - vertex0;
-	edge2 = vertex2 - vertex0;
-	h = glm::cross(ray.direction, edge2);
-	a = glm::dot(edge1, h);
-	if (a > -EPSILON && a < EPSILON) {
-		return Intersection{}; // no intersection
+bool Triangles::intersect(Ray const &ray, Hit &hit) const {
+	// Find the nearest triangle by comparing t along the ray
+	float tMax = hit.t;
+	float u = 0.0f, v = 0.0f;
+	int nearest = -1;
+	bvh.traverseLeaves(ray, tMax, [&](int first, int count, float &tMax) {
+		soa.touch(first, count);
+		int found = intersectTriangleSoA(soa, ray, first, count, tMax, u, v);
+		if (found >= 0) {
+			nearest = found;
+		}
+	});
+
+	if (nearest < 0) {
+		return false;
 	}
-	f = 1.0/a;
-	s = ray.origin - vertex0;
-	u = f * glm::dot(s, h);
-	if (u < 0.0 || u > 1.0) {
-		return Intersection{}; // no intersection
+	hit.t = tMax;
+	hit.prim = nearest;
+	hit.u = u;
+	hit.v = v;
+	return true;
+}
+
+uint32_t Triangles::intersectPacket(RayPacket const &packet, uint32_t active, Hit *hits) const {
+	// Walk the mesh BVH once for the whole packet and run the triangle kernel
+	// for each lane that reaches a leaf.
+	float tMax[RayPacket::SIZE];
+	float u[RayPacket::SIZE], v[RayPacket::SIZE];
+	int nearest[RayPacket::SIZE];
+	for (int lane = 0; lane < RayPacket::SIZE; lane++) {
+		tMax[lane] = hits[lane].t;
+		nearest[lane] = -1;
 	}
-	q = glm::cross(s, edge1);
-	v = f * glm::dot(ray.direction, q);
-	if (v < 0.0 || u + v > 1.0) {
-		return Intersection{}; // no intersection
+
+	bvh.traversePacket(packet, active, tMax, [&](int first, int count, uint32_t lanes) {
+		soa.touch(first, count);
+		forEachLane(lanes, [&](int lane) {
+			int found = intersectTriangleSoA(soa, packet.ray(lane), first, count, tMax[lane], u[lane], v[lane]);
+			if (found >= 0) {
+				nearest[lane] = found;
+			}
+		});
+	});
+
+	uint32_t closer = 0;
+	forEachLane(active, [&](int lane) {
+		if (nearest[lane] >= 0) {
+			hits[lane].t = tMax[lane];
+			hits[lane].prim = nearest[lane];
+			hits[lane].u = u[lane];
+			hits[lane].v = v[lane];
+			closer |= 1u << lane;
+		}
+	});
+	return closer;
+}
+
+vec3 Triangles::normalAt(Ray const &, Hit const &hit) const {
+	return glm::normalize(glm::cross(soa.edge1(hit.prim), soa.edge2(hit.prim)));
+}
+
+bool Triangles::occluded(Ray const &ray, float tMax) const {
+	return bvh.traverseLeavesAny(ray, tMax, [&](int first, int count) {
+		// The kernel finds the nearest triangle of the leaf past OCCLUSION_T_MIN,
+		// all we need is whether there is one
+		soa.touch(first, count);
+		float t = tMax;
+		return intersectTriangleSoA(soa, ray, first, count, OCCLUSION_T_MIN, t) >= 0;
+	});
+}
+
+Instance::Instance(std::shared_ptr<const Triangles> m, mat4x3 transform, int ID)
+	: mesh(std::move(m))
+{
+	id = ID;
+	setTransform(transform);
+}
+
+void Instance::setTransform(mat4x3 transform) {
+	objectToWorld = transform;
+	worldToObject = mat4x3(glm::inverse(mat4(transform)));
+}
+
+AABB Instance::bounds() const {
+	// The world space box around the corners of the mesh's box
+	AABB box;
+	if (mesh->bvh.empty()) {
+		return box;
 	}
-	// At this stage we can compute t to find out where the intersection point is on the line.
-	float t = f * glm::dot(edge2, q);
-	// ray intersection
-	if (t > EPSILON) {
-		Intersection p;
-		p.point = ray.origin + ray.direction * t;
-		p.normal = glm::normalize(glm::cross(edge1, edge2));
-		p.material = material;
-		p.numberOfIntersections = 1;
-		p.id = id;
-		return p;
-	} else {
-		// This means that there is a line intersection but not a ray intersection.
-		return Intersection{}; // no intersection
+	AABB const &local = mesh->bvh.bounds();
+	for (int corner = 0; corner < 8; corner++) {
+		vec3 p(
+			(corner & 1) ? local.max.x : local.min.x,
+			(corner & 2) ? local.max.y : local.min.y,
+			(corner & 4) ? local.max.z : local.min.z
+		);
+		box.extend(objectToWorld * vec4(p, 1.0f));
 	}
+	return box;
 }
 
+bool Instance::intersect(Ray const &ray, Hit &hit) const {
+	return intersectSlot(slot(-1), ray, hit);
+}
 
-Intersection Triangles::getIntersection(Ray ray){
-	Intersection result{};
-	result.material = material;
-	result.id = id;
-	float min = 9999;
-	result = intersectTriangle(ray, triangles.at(0));
-	if(result.numberOfIntersections!=0)min = glm::distance(result.point, ray.origin);
-	for(int i = 1; i<triangles.size() ;i++){
-		Intersection p = intersectTriangle(ray, triangles.at(i));
-		if(p.numberOfIntersections !=0 && glm::distance(p.point, ray.origin) < min){
-			min = glm::distance(p.point, ray.origin);
-			result = p;
-		}
-	}
+vec3 Instance::normalAt(Ray const &ray, Hit const &hit) const {
+	// Normals go back to world space by the inverse transpose
+	return glm::normalize(glm::transpose(mat3(worldToObject)) * mesh->normalAt(ray, hit));
+}
+
+bool Instance::occluded(Ray const &ray, float tMax) const {
+	return occludedSlot(slot(-1), ray, tMax);
+}
+
+InstanceSlot Instance::slot(int shapeIndex) const {
+	return { mesh.get(), mat3(worldToObject), worldToObject[3], shapeIndex, id };
+}
+
+void Instance::addTo(ShapeBuckets &buckets, int shapeIndex) const {
+	buckets.instances.add(slot(shapeIndex), bounds());
+}
+
+bool Plane::intersect(Ray const &ray, Hit &hit) const {
+	return intersectSlot(slot(-1), ray, hit);
+}
+
+vec3 Plane::normalAt(Ray const &, Hit const &) const {
+	return normal;
+}
+
+bool Plane::occluded(Ray const &ray, float tMax) const {
+	return occludedSlot(slot(-1), ray, tMax);
+}
+
+PlaneSlot Plane::slot(int shapeIndex) const {
+	return { point, normal, shapeIndex, id };
+}
 
-	result.material = material;
-	result.id = id;
-	return result;
-}
-
-Intersection Plane::getIntersection(Ray ray){
-	Intersection result;
-	result.material = material;
-	result.id = id;
-	result.normal = normal;
-	if(dot(normal, ray.direction)>=0)return result;
-	float s = dot(point - ray.origin, normal)/dot(ray.direction, normal);
-	//if(s<0.00001)return result;
-	result.numberOfIntersections = 1;
-	result.point = ray.origin + s*ray.direction;
-	return result;
+void Plane::addTo(ShapeBuckets &buckets, int shapeIndex) const {
+	buckets.planes.push_back(slot(shapeIndex));
 }
@@ -11,45 +11,54 @@
 //------------------------------------------------------------------------------
 #pragma once
 
+#include <limits>
+#include <memory>
 #include <vector>
 #include <string>
 #include <glm/glm.hpp>
 #include <iostream>
 
 #include "Material.h"
+#include "Ray.h"
+#include "BVH.h"
+#include "WideBVH.h"
+#include "RayPacket.h"
+#include "TriangleKernel.h"
 
 using namespace std;
 using namespace glm;
+struct ShapeBuckets;
+struct SphereSlot;
+struct CylinderSlot;
+struct PlaneSlot;
+struct InstanceSlot;
+
 float dot_normalized(vec3 v1, vec3 v2);
 void debug(char* str, vec3 a);
 
-struct Ray {
-	vec3 origin;
-	vec3 direction;
-
-	Ray(vec3 point, vec3 dir){
-		origin = point;
-		direction = dir;
-	}
-	Ray(): origin(vec3(0,0,0)), direction(vec3(0,0,0))
-	{}
+// What a ray hit, found while searching for the closest hit. It is kept small
+// on purpose: the normal, the hit point and the material are only worked out
+// (see Shape::normalAt) once the closest hit of a ray is known.
+struct Hit {
+	float t = std::numeric_limits<float>::max(); // ray parameter of the hit
+	int shape = -1; // index into Scene::shapesInScene, -1 for a miss
+	int prim = -1;  // triangle of a Triangles mesh (in the order of its BVH leaves)
+	float u = 0.0f; // barycentric coordinates on that triangle
+	float v = 0.0f;
+
+	bool found() const { return shape >= 0; }
 };
 
+// A hit with everything needed to shade it
 struct Intersection{
-	int numberOfIntersections;
+	bool found;
 	vec3 point;
 	vec3 normal;
 	int id;
+	int shape;    // index into Scene::shapesInScene, -1 if nothing was hit
+	int material; // index into Scene::materials
 
-	ObjectMaterial material;
-
-	Intersection(int no, vec3 n, vec3 f, vec3 nor, int ID){
-		numberOfIntersections = no;
-		point = n;
-		normal = nor;
-		id = ID;
-	}
-	Intersection(): numberOfIntersections(0), point(0,0,0), normal(0,0,0), id(-1), material()
+	Intersection(): found(false), point(0,0,0), normal(0,0,0), id(-1), shape(-1), material(0)
 	{}
 };
 
@@ -69,10 +78,35 @@ struct Triangle{
 
 class Shape{
 public:
-	virtual Intersection getIntersection(Ray ray) = 0;
+	// Closest hit search. If the ray hits the shape at some t with 0 < t < hit.t,
+	// lowers hit.t to it, sets hit.prim / hit.u / hit.v if the shape uses them
+	// and returns true. Setting hit.shape is up to the caller.
+	virtual bool intersect(Ray const &ray, Hit &hit) const = 0;
+
+	// Packet version of intersect for the lanes in `active`. Returns the lanes
+	// whose hit it lowered.
+	virtual uint32_t intersectPacket(RayPacket const &packet, uint32_t active, Hit *hits) const;
+
+	// Unit surface normal at a hit that intersect() found on this shape
+	virtual vec3 normalAt(Ray const &ray, Hit const &hit) const = 0;
+
+	// World space bounds of the shape. Shapes that go on forever (planes)
+	// return false from hasBounds() and are kept out of the scene's BVH.
+	virtual AABB bounds() const = 0;
+	virtual bool hasBounds() const { return true; }
+
+	// Any hit query for shadow rays: does the ray hit the shape anywhere with
+	// OCCLUSION_T_MIN < t < tMax? Skips normals and materials, and compares
+	// ray parameters rather than distances.
+	virtual bool occluded(Ray const &ray, float tMax) const = 0;
+
+	// Adds the shape's geometry to the bucket for its kind of shape (see
+	// ShapeBuckets.h). shapeIndex is the shape's index in Scene::shapesInScene.
+	virtual void addTo(ShapeBuckets &buckets, int shapeIndex) const = 0;
 
 	int id;
 	ObjectMaterial material;
+	int materialIndex = 0; // where buildMaterialTable put `material` in Scene::materials
 
 	Shape(): material()
 	{}
@@ -80,10 +114,20 @@ public:
 
 class Triangles: public Shape{
 public:
-	vector<Triangle> triangles;
-	Intersection getIntersection(Ray ray);
-	Intersection intersectTriangle(Ray ray, Triangle t);
+	WideBVH bvh;     // over the triangles (4 wide, see WideBVH.h), rebuilt by initTriangles
+	TriangleSoA soa; // the triangles, in the BVH's leaf order, for the SIMD kernel
+	AABB box;        // around all the triangles
+
+	// Set if bvh and soa live in a mapped mesh file, see MeshFile.h
+	std::shared_ptr<PageBudget> pages;
+
+	bool intersect(Ray const &ray, Hit &hit) const;
+	uint32_t intersectPacket(RayPacket const &packet, uint32_t active, Hit *hits) const;
+	vec3 normalAt(Ray const &ray, Hit const &hit) const;
+	bool occluded(Ray const &ray, float tMax) const;
+	void addTo(ShapeBuckets &buckets, int shapeIndex) const;
 	void initTriangles(int num, vec3* t, int ID);
+	AABB bounds() const;
 };
 
 class Sphere: public Shape{
@@ -91,7 +135,12 @@ public:
 	vec3 centre;
 	float radius;
 	Sphere(vec3 c, float r, int ID);
-	Intersection getIntersection(Ray ray);
+	bool intersect(Ray const &ray, Hit &hit) const;
+	vec3 normalAt(Ray const &ray, Hit const &hit) const;
+	bool occluded(Ray const &ray, float tMax) const;
+	void addTo(ShapeBuckets &buckets, int shapeIndex) const;
+	SphereSlot slot(int shapeIndex) const;
+	AABB bounds() const;
 };
 
 class Cylinder : public Shape {
@@ -103,7 +152,33 @@ public:
 	mat3 orientationInv; //world space to local
 
 	Cylinder(vec3 c, float r, int ID, float h, mat3 rot);
-	Intersection getIntersection(Ray ray);
+	bool intersect(Ray const &ray, Hit &hit) const;
+	vec3 normalAt(Ray const &ray, Hit const &hit) const;
+	bool occluded(Ray const &ray, float tMax) const;
+	void addTo(ShapeBuckets &buckets, int shapeIndex) const;
+	CylinderSlot slot(int shapeIndex) const;
+	AABB bounds() const;
+};
+
+// Another copy of a mesh, somewhere else in the scene. The mesh (triangles and
+// BVH) is shared by all of its instances and each one only adds a transform,
+// so placing a mesh a thousand times doesn't copy its triangles a thousand
+// times. Rays are moved into the mesh's space to be traced, the same way
+// Cylinder does with orientationInv.
+class Instance : public Shape {
+public:
+	std::shared_ptr<const Triangles> mesh; // only used for its geometry, not its material or id
+	mat4x3 objectToWorld; // 3x4: the first three columns rotate and scale, the last one moves
+	mat4x3 worldToObject;
+
+	Instance(std::shared_ptr<const Triangles> m, mat4x3 transform, int ID);
+	void setTransform(mat4x3 transform);
+	bool intersect(Ray const &ray, Hit &hit) const;
+	vec3 normalAt(Ray const &ray, Hit const &hit) const;
+	bool occluded(Ray const &ray, float tMax) const;
+	void addTo(ShapeBuckets &buckets, int shapeIndex) const;
+	InstanceSlot slot(int shapeIndex) const;
+	AABB bounds() const;
 };
 
 class Plane: public Shape{
@@ -111,6 +186,12 @@ public:
 	vec3 point;
 	vec3 normal;
 	Plane(vec3 p, vec3 n, int ID);
-	Intersection getIntersection(Ray ray);
+	bool intersect(Ray const &ray, Hit &hit) const;
+	vec3 normalAt(Ray const &ray, Hit const &hit) const;
+	bool occluded(Ray const &ray, float tMax) const;
+	void addTo(ShapeBuckets &buckets, int shapeIndex) const;
+	PlaneSlot slot(int shapeIndex) const;
+	AABB bounds() const;
+	bool hasBounds() const { return false; }
 };
 
@@ -0,0 +1,36 @@
+#include "RenderJob.h"
+
+#include <chrono>
+
+RenderJob::RenderJob(Scene scene, Framebuffer &image, glm::vec3 viewPoint, TileScheduler &scheduler, RenderSettings const &settings, GBuffer *primaryHits, DependencyBuffer *dependencies)
+	: jobScene(std::move(scene))
+{
+	result = std::async(std::launch::async, [this, &image, viewPoint, &scheduler, settings, primaryHits, dependencies] {
+		return raytraceImage(jobScene, image, viewPoint, scheduler, settings, &cancelled, primaryHits, dependencies);
+	}).share();
+}
+
+RenderJob::RenderJob(Scene scene, Framebuffer &image, GBuffer const &primaryHits, TileScheduler &scheduler, RenderSettings const &settings)
+	: jobScene(std::move(scene))
+{
+	result = std::async(std::launch::async, [this, &image, &primaryHits, &scheduler, settings] {
+		return relightImage(jobScene, primaryHits, image, scheduler, settings, &cancelled);
+	}).share();
+}
+
+RenderJob::RenderJob(Scene scene, Scene oldScene, std::vector<int> changedShapes, Framebuffer &image, TileScheduler &scheduler, DependencyBuffer &dependencies, RenderSettings const &settings, GBuffer *primaryHits)
+	: jobScene(std::move(scene))
+{
+	result = std::async(std::launch::async, [this, oldScene = std::move(oldScene), changedShapes = std::move(changedShapes), &image, &scheduler, &dependencies, settings, primaryHits] {
+		return rerenderShapes(jobScene, oldScene, changedShapes, image, scheduler, dependencies, settings, &cancelled, primaryHits);
+	}).share();
+}
+
+RenderJob::~RenderJob() {
+	cancel();
+	result.wait();
+}
+
+bool RenderJob::done() const {
+	return result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
@@ -0,0 +1,77 @@
+//------------------------------------------------------------------------------
+// A render of one image running in the background, that can be called off.
+//
+// The job checks its cancel flag before every tile, so once cancel() is called
+// it stops within about one tile's worth of tracing. That makes it cheap to
+// throw a render away when the scene or camera changes before it's finished:
+// cancel the old job, wait for it, and start a new one (see supersede()).
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Framebuffer.h"
+#include "GBuffer.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "ShapeDependencies.h"
+#include "TileScheduler.h"
+
+class RenderJob {
+public:
+	// Starts rendering the scene into the image on a thread of its own. The
+	// job keeps the scene, but the image, scheduler, primaryHits and
+	// dependencies (which are filled in for relighting and rerenderShapes
+	// later, if given) have to outlive it.
+	RenderJob(Scene scene, Framebuffer &image, glm::vec3 viewPoint, TileScheduler &scheduler, RenderSettings const &settings, GBuffer *primaryHits = nullptr, DependencyBuffer *dependencies = nullptr);
+
+	// Starts relighting the image from the camera hits of an earlier render
+	// (see relightImage), with the scene's new light and materials
+	RenderJob(Scene scene, Framebuffer &image, GBuffer const &primaryHits, TileScheduler &scheduler, RenderSettings const &settings);
+
+	// Starts bringing an image of oldScene up to date with the scene, after
+	// the shapes in changedShapes were edited (see rerenderShapes)
+	RenderJob(Scene scene, Scene oldScene, std::vector<int> changedShapes, Framebuffer &image, TileScheduler &scheduler, DependencyBuffer &dependencies, RenderSettings const &settings, GBuffer *primaryHits = nullptr);
+
+	// Cancels the job and waits for the tiles that are being traced
+	~RenderJob();
+
+	RenderJob(RenderJob const &) = delete;
+	RenderJob &operator=(RenderJob const &) = delete;
+
+	// Tiles that haven't been started yet are skipped. Doesn't wait.
+	void cancel() { cancelled = true; }
+
+	// True once the job has stopped, finished or not
+	bool done() const;
+
+	// Waits for the job to stop. True if every tile of the image was traced.
+	bool wait() const { return result.get(); }
+
+	// Same as wait(), for callers that would rather hold on to a future
+	std::shared_future<bool> const &future() const { return result; }
+
+	Scene const &scene() const { return jobScene; }
+
+private:
+	Scene jobScene;
+	std::atomic<bool> cancelled{false};
+	std::shared_future<bool> result;
+};
+
+// Cancels `current` (if there is one), waits for the tiles it has in flight,
+// and replaces it with the job returned by startNext(). startNext only runs
+// once the old job has stopped writing to the image, so it can reset it first.
+template <typename F>
+void supersede(std::unique_ptr<RenderJob> &current, F &&startNext) {
+	if (current) {
+		current->cancel();
+		current.reset();
+	}
+	current = startNext();
+}
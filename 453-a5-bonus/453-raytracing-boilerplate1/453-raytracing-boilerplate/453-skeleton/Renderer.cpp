@@ -0,0 +1,562 @@
+#include <cmath>
+
+#include "Renderer.h"
+#include "AllocationCounter.h"
+#include "Camera.h"
+#include "Lighting.h"
+#include "Log.h"
+#include "Wavefront.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+
+bool occluded(Scene const &scene, Ray const &ray, float tMax, int skipID) {
+	return scene.accel->occluded(ray, tMax, skipID);
+}
+
+Hit getClosestHit(Scene const &scene, Ray const &ray, int skipID) {
+	// Sometimes you need to skip certain shapes. Useful to
+	// avoid self-intersection. ;)
+	Hit hit;
+	scene.accel->intersect(ray, skipID, hit);
+	return hit;
+}
+
+Intersection resolveHit(Scene const &scene, Ray const &ray, Hit const &hit) {
+	Intersection result;
+	if (!hit.found()) {
+		return result;
+	}
+	Shape const &shape = *scene.shapesInScene[hit.shape];
+	result.found = true;
+	result.point = ray.origin + hit.t * ray.direction;
+	result.normal = shape.normalAt(ray, hit);
+	result.id = shape.id;
+	result.shape = hit.shape;
+	result.material = shape.materialIndex;
+	return result;
+}
+
+Intersection getClosestIntersection(Scene const &scene, Ray ray, int skipID){ //get the nearest
+	return resolveHit(scene, ray, getClosestHit(scene, ray, skipID));
+}
+
+void getClosestIntersections(Scene const &scene, RayPacket const &packet, uint32_t active, Intersection *hits) {
+	// Same as getClosestIntersection, for every lane at once
+	Hit closest[RayPacket::SIZE];
+	scene.accel->intersectPacket(packet, active, closest);
+	forEachLane(active, [&](int lane) {
+		hits[lane] = resolveHit(scene, packet.ray(lane), closest[lane]);
+	});
+}
+
+
+glm::vec3 raytraceSingleRay(Scene const &scene, Ray const &ray, int level, int source_id, RenderSettings const &settings) {
+	// TODO: Part 3: Somewhere in this function you will need to add the code to determine
+	//               if a given point is in shadow or not. Think carefully about what parts
+	//               of the lighting equation should be used when a point is in shadow.
+	// TODO: Part 4: Somewhere in this function you will need to add the code that does reflections and refractions.
+	//               NOTE: The ObjectMaterial class already has a parameter to store the object's
+	//               reflective properties. Use this parameter + the color coming back from the
+	//               reflected array and the color from the phong shading equation.
+	Intersection result = getClosestIntersection(scene, ray, source_id); //find intersection
+	return shadeIntersection(scene, ray, result, level, settings);
+}
+
+namespace {
+
+// A ray of the ray tree that still has to be followed, and how much of the
+// colour it sees ends up in the pixel
+struct RaySegment {
+	Ray ray;
+	int sourceID;     // shape the ray leaves from, skipped when looking for hits
+	int level;        // bounces it may still take
+	glm::vec3 weight;
+};
+
+// The tree is walked depth first, and every segment adds at most one waiting
+// sibling to the stack, so it never holds more than level + 1 segments
+const int RAY_TREE_STACK_SIZE = 64;
+
+struct RayTreeStack {
+	RaySegment segments[RAY_TREE_STACK_SIZE];
+	int size = 0;
+};
+
+// A number in [0, 1) that only depends on the ray, so Russian roulette picks
+// the same rays (and makes the same image) on any number of threads
+float rouletteNumber(Ray const &ray) {
+	float const values[6] = { ray.origin.x, ray.origin.y, ray.origin.z, ray.direction.x, ray.direction.y, ray.direction.z };
+	uint32_t hash = 2166136261u;
+	for (float value : values) {
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		hash = (hash ^ bits) * 16777619u;
+	}
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return (hash >> 8) * (1.0f / 16777216.0f);
+}
+
+// Adds what the segment sees directly at its hit to colour, and pushes its
+// reflection and refraction rays if they still carry enough weight
+void shadeSegment(Scene const &scene, RaySegment const &segment, Intersection const &result, RenderSettings const &settings, glm::vec3 &colour, RayTreeStack &stack, DependencyRecorder *dependencies) {
+	if (dependencies) {
+		dependencies->ray(segment.ray, result);
+	}
+
+	//return local color on recursion limit
+	if (segment.level < 1) {
+		PhongReflection phong(result, scene.materials[result.material], segment.ray, scene);
+		colour += segment.weight * phong.I();
+		return;
+	}
+
+	if(!result.found) return; // black;
+
+	SurfaceScatter scatter;
+	scatterAt(scene, segment.ray, result, scatter);
+
+	//part 3
+	glm::vec3 localColor;
+	if (dependencies) {
+		dependencies->shadowRay(scatter.shadowRay, scene.lightPosition);
+	}
+	if (occluded(scene, scatter.shadowRay, scatter.lightDistance, result.id)) { //in shadow, only use ambient component of material
+		localColor = scatter.shadowedColor;
+	}
+	else {
+		localColor = scatter.litColor;
+	}
+	colour += segment.weight * scatter.localShare * localColor;
+
+	//part 4
+	for (int i = 0; i < scatter.rayCount; i++) {
+		glm::vec3 weight = segment.weight * scatter.shares[i];
+		if (keepRay(scatter.rays[i], weight, settings) && stack.size < RAY_TREE_STACK_SIZE) {
+			stack.segments[stack.size++] = { scatter.rays[i], result.id, segment.level - 1, weight };
+		}
+	}
+}
+
+} // namespace
+
+void scatterAt(Scene const &scene, Ray const &ray, Intersection const &result, SurfaceScatter &scatter) {
+	PhongReflection phong(result, scene.materials[result.material], ray, scene);
+
+	vec3 lightDirection = glm::normalize(scene.lightPosition - result.point);
+	scatter.shadowRay = Ray(result.point + result.normal * 0.001f, lightDirection);
+	// The direction is normalized, so t is the distance along the shadow ray
+	scatter.lightDistance = glm::distance(scatter.shadowRay.origin, scene.lightPosition) - 0.01f;
+	scatter.litColor = phong.I();
+	scatter.shadowedColor = phong.Ia();
+
+	// How the ray's colour is split between the surface itself, its
+	// reflection, and what is seen through it
+	float avgReflection = (phong.material.reflectionStrength.r + phong.material.reflectionStrength.g + phong.material.reflectionStrength.b) / 3.0f;
+	float reflectionShare = avgReflection > 0.0f ? avgReflection : 0.0f;
+	float refractionShare = phong.material.refractiveIndex > 1.0f ? 0.5f : 0.0f;
+	scatter.localShare = (1.0f - reflectionShare) * (1.0f - refractionShare);
+	scatter.rayCount = 0;
+
+	//refraction
+	if (refractionShare > 0.0f) {
+		float etai = 1.0f;
+		float etat = phong.material.refractiveIndex;
+		glm::vec3 N = result.normal;
+		float cosi = glm::dot(ray.direction, N);
+
+		//ray inside object
+		if (cosi > 0.0f) {
+			std::swap(etai, etat);
+			N = -N;
+			cosi = glm::dot(ray.direction, N);
+		}
+
+		float eta = etai / etat;
+		float k = 1.0f - eta * eta * (1.0f - cosi * cosi);
+		glm::vec3 refractionDir;
+		if (k < 0.0f) {
+			glm::vec3 D = ray.direction;
+			refractionDir = D - 2.0f * glm::dot(D, N) * N;
+		}
+		else {
+			refractionDir = eta * ray.direction + (eta * cosi - sqrtf(k)) * N;
+		}
+
+		refractionDir = glm::normalize(refractionDir);
+		scatter.rays[scatter.rayCount] = Ray(result.point - N * 0.001f, refractionDir);
+		scatter.shares[scatter.rayCount++] = refractionShare;
+	}
+
+	//reflection
+	if (reflectionShare > 0.0f) {
+		glm::vec3 D = ray.direction;
+		glm::vec3 N = result.normal;
+		glm::vec3 reflectionDir = D - 2.0f * glm::dot(D, N) * N; //R = D - 2(N*D)N
+		scatter.rays[scatter.rayCount] = Ray(result.point + N * 0.001f, reflectionDir);
+		scatter.shares[scatter.rayCount++] = reflectionShare * (1.0f - refractionShare);
+	}
+}
+
+bool keepRay(Ray const &ray, glm::vec3 &weight, RenderSettings const &settings) {
+	float throughput = glm::max(weight.r, glm::max(weight.g, weight.b));
+	if (throughput >= settings.minThroughput) {
+		return true;
+	}
+	if (!settings.russianRoulette) {
+		return false;
+	}
+	// Keep the ray now and then, and make up for the ones dropped
+	float survival = throughput / settings.minThroughput;
+	if (rouletteNumber(ray) >= survival) {
+		return false;
+	}
+	weight /= survival;
+	return true;
+}
+
+glm::vec3 shadeIntersection(Scene const &scene, Ray const &ray, Intersection const &result, int level, RenderSettings const &settings, DependencyRecorder *dependencies) {
+	// The reflection and refraction rays are followed off a stack instead of
+	// by recursion, and each adds its share of the pixel colour on its own
+	glm::vec3 finalColor(0.0f);
+	RayTreeStack stack;
+	shadeSegment(scene, { ray, -1, level, glm::vec3(1.0f) }, result, settings, finalColor, stack, dependencies);
+	while (stack.size > 0) {
+		RaySegment segment = stack.segments[--stack.size];
+		Intersection hit = getClosestIntersection(scene, segment.ray, segment.sourceID);
+		shadeSegment(scene, segment, hit, settings, finalColor, stack, dependencies);
+	}
+	return finalColor;
+}
+
+namespace {
+
+// raytraceImage, and rerenderShapes when only the tiles in onlyTiles (if
+// given) are traced again: the preview is skipped, the other tiles keep
+// their pixels, and primaryHits and dependencies are updated rather than
+// started over.
+bool traceImage(Scene const &scene, Framebuffer &image, glm::vec3 viewPoint, TileScheduler &scheduler, RenderSettings const &settings, std::atomic<bool> const *cancel, GBuffer *primaryHits, DependencyBuffer *dependencies, std::vector<bool> const *onlyTiles) {
+	if (!scene.accel) {
+		Log::error("Scene has no BVH, call buildSceneBVH() after adding shapes to it");
+		return false;
+	}
+
+	// Checked before every tile, so a cancelled render stops within a tile
+	auto cancelled = [cancel] {
+		return cancel && cancel->load(std::memory_order_relaxed);
+	};
+
+	// The rays to cast for this given image / viewpoint, made as they're needed
+	CameraRays camera(image.Width(), image.Height(), viewPoint);
+
+	if (settings.previewBlockSize > 1 && !onlyTiles) {
+		// Quick first pass: one ray per block of pixels, through its centre,
+		// coloured over the whole block. The full pass below overwrites it.
+		int block = settings.previewBlockSize;
+		scheduler.run(image.Width(), image.Height(), block * RENDER_TILE_SIZE / 2, [&](Tile const &tile, int) {
+			if (cancelled()) {
+				return;
+			}
+			std::vector<glm::vec3> colours(tile.width() * tile.height());
+			for (int by = tile.y0; by < tile.y1; by += block) {
+				for (int bx = tile.x0; bx < tile.x1; bx += block) {
+					int x1 = std::min(bx + block, tile.x1);
+					int y1 = std::min(by + block, tile.y1);
+					glm::vec3 colour = raytraceSingleRay(scene, camera.ray((bx + x1) / 2, (by + y1) / 2), RENDER_MAX_DEPTH, -1, settings);
+					for (int y = by; y < y1; y++) {
+						std::fill_n(&colours[(y - tile.y0) * tile.width() + (bx - tile.x0)], x1 - bx, colour);
+					}
+				}
+			}
+			image.SetPixels(tile.x0, tile.y0, tile.width(), tile.height(), colours.data());
+		}, settings.pixelOrder);
+	}
+
+	// Where in each pixel its camera rays go
+	int samples = std::max(settings.samplesPerPixel, 1);
+
+	// With adaptive sampling the full pass traces one ray per pixel, and a
+	// second pass spends the rest of the budget on the pixels that need it.
+	bool adaptive = settings.adaptiveSampling && samples > 1;
+
+	// The camera hits are only worth keeping if there's one per pixel, and
+	// the dependencies only cover the tiles of the full pass
+	if (primaryHits) {
+		if (!onlyTiles) {
+			primaryHits->reset(image.Width(), image.Height(), viewPoint);
+		}
+		bool stale = onlyTiles && (!primaryHits->valid || primaryHits->width != image.Width() || primaryHits->height != image.Height());
+		if (samples > 1 || settings.wavefront || stale) {
+			primaryHits = nullptr;
+		}
+	}
+	if (dependencies) {
+		if (!onlyTiles) {
+			dependencies->reset(image.Width(), image.Height(), RENDER_TILE_SIZE, viewPoint, scene);
+		}
+		if (adaptive || settings.wavefront) {
+			dependencies = nullptr;
+		}
+	}
+
+	if (settings.wavefront) {
+		return raytraceImageWavefront(scene, image, camera, scheduler, settings, cancel);
+	}
+
+	std::vector<glm::vec2> sampleOffsets(samples);
+	for (int i = 0; i < samples; i++) {
+		sampleOffsets[i] = pixelSampleOffset(i);
+	}
+	auto sampleRay = [&](int x, int y, int sample) {
+		return camera.rayThrough(x + sampleOffsets[sample].x, y + sampleOffsets[sample].y);
+	};
+
+	int passSamples = adaptive ? 1 : samples;
+	float sampleWeight = 1.0f / passSamples;
+
+	// What the full pass saw, for the adaptive pass to compare neighbours with
+	int width = image.Width();
+	std::vector<glm::vec3> baseColours(adaptive ? width * image.Height() : 0);
+	std::vector<int> baseIDs(baseColours.size());
+
+	// The order the pixels (traced one at a time) or 4x4 packets of a tile are
+	// traced in. Tiles at the edges of the image skip the ones outside it.
+	std::vector<glm::ivec2> pixelOrder = traversalOrder(RENDER_TILE_SIZE, RENDER_TILE_SIZE, settings.pixelOrder);
+	std::vector<glm::ivec2> packetOrder = traversalOrder(RENDER_TILE_SIZE / RayPacket::WIDTH, RENDER_TILE_SIZE / RayPacket::WIDTH, settings.pixelOrder);
+
+	// Allocations made while tracing (as opposed to setting up the tile or
+	// copying it to the image). Only counted in COUNT_ALLOCATIONS builds.
+	std::atomic<uint64_t> tracingAllocations{0};
+
+	// Each tile is traced into a small local buffer and then copied into the
+	// image in one go, so the render threads only contend on the image once
+	// per tile rather than once per pixel.
+	std::atomic<int> tracedTiles{0};
+	scheduler.run(image.Width(), image.Height(), RENDER_TILE_SIZE, [&](Tile const &tile, int) {
+		if (cancelled()) {
+			return;
+		}
+		if (onlyTiles && !(*onlyTiles)[(tile.y0 / RENDER_TILE_SIZE) * dependencies->tilesX + tile.x0 / RENDER_TILE_SIZE]) {
+			return;
+		}
+		tracedTiles++;
+		std::vector<glm::vec3> colours(tile.width() * tile.height());
+		DependencyRecorder recorder{ nullptr, nullptr };
+		if (dependencies) {
+			recorder = { &dependencies->tile(tile), dependencies };
+			recorder.tile->clear(dependencies->shapeCount);
+		}
+		uint64_t allocationsBefore = allocationCount();
+		auto cameraRay = [&](int x, int y, int sample) {
+			return passSamples == 1 ? camera.ray(x, y) : sampleRay(x, y, sample);
+		};
+		auto store = [&](int x, int y, Ray const &ray, Intersection const &hit) {
+			colours[(y - tile.y0) * tile.width() + (x - tile.x0)] += shadeIntersection(scene, ray, hit, RENDER_MAX_DEPTH, settings, dependencies ? &recorder : nullptr);
+			if (adaptive) {
+				baseIDs[y * width + x] = hit.id;
+			}
+			if (primaryHits) {
+				primaryHits->at(x, y) = hit;
+			}
+		};
+		for (int sample = 0; sample < passSamples; sample++) {
+			if (settings.packets) {
+				// Camera rays of neighbouring pixels go through the scene together
+				for (glm::ivec2 block : packetOrder) {
+					int bx = tile.x0 + block.x * RayPacket::WIDTH;
+					int by = tile.y0 + block.y * RayPacket::WIDTH;
+					if (bx < tile.x1 && by < tile.y1) {
+						RayPacket packet;
+						uint32_t active = 0;
+						for (int lane = 0; lane < RayPacket::SIZE; lane++) {
+							int x = std::min(bx + lane % RayPacket::WIDTH, tile.x1 - 1);
+							int y = std::min(by + lane / RayPacket::WIDTH, tile.y1 - 1);
+							packet.set(lane, cameraRay(x, y, sample));
+							if (bx + lane % RayPacket::WIDTH < tile.x1 && by + lane / RayPacket::WIDTH < tile.y1) {
+								active |= 1u << lane;
+							}
+						}
+
+						Intersection hits[RayPacket::SIZE];
+						getClosestIntersections(scene, packet, active, hits);
+						forEachLane(active, [&](int lane) {
+							store(bx + lane % RayPacket::WIDTH, by + lane / RayPacket::WIDTH, packet.ray(lane), hits[lane]);
+						});
+					}
+				}
+			} else {
+				for (glm::ivec2 cell : pixelOrder) {
+					int x = tile.x0 + cell.x;
+					int y = tile.y0 + cell.y;
+					if (x < tile.x1 && y < tile.y1) {
+						Ray ray = cameraRay(x, y, sample);
+						store(x, y, ray, getClosestIntersection(scene, ray, -1));
+					}
+				}
+			}
+		}
+		for (glm::vec3 &colour : colours) {
+			colour *= sampleWeight;
+		}
+		tracingAllocations += allocationCount() - allocationsBefore;
+		if (adaptive) {
+			for (int y = tile.y0; y < tile.y1; y++) {
+				std::copy_n(&colours[(y - tile.y0) * tile.width()], tile.width(), &baseColours[y * width + tile.x0]);
+			}
+		}
+		image.SetPixels(tile.x0, tile.y0, tile.width(), tile.height(), colours.data());
+	}, settings.pixelOrder);
+
+	// Adaptive pass: a pixel that hit a different shape than one of its
+	// neighbours, or whose colour differs from theirs by more than the
+	// threshold, is on an edge (a silhouette, a shadow, a reflection) and gets
+	// more rays. It stops once its samples agree well enough, or when it runs
+	// out of budget.
+	std::atomic<uint64_t> adaptiveSamples{0};
+	if (adaptive) {
+		int height = image.Height();
+		float threshold = settings.adaptiveThreshold;
+		auto onEdge = [&](int x, int y) {
+			int i = y * width + x;
+			auto differs = [&](int j) {
+				glm::vec3 d = glm::abs(baseColours[i] - baseColours[j]);
+				return baseIDs[i] != baseIDs[j] || glm::max(d.r, glm::max(d.g, d.b)) > threshold;
+			};
+			return (x > 0 && differs(i - 1)) || (x + 1 < width && differs(i + 1))
+				|| (y > 0 && differs(i - width)) || (y + 1 < height && differs(i + width));
+		};
+
+		scheduler.run(image.Width(), image.Height(), RENDER_TILE_SIZE, [&](Tile const &tile, int) {
+			if (cancelled()) {
+				return;
+			}
+			std::vector<glm::vec3> colours(tile.width() * tile.height());
+			bool refined = false;
+			uint64_t tileSamples = 0;
+			for (glm::ivec2 cell : pixelOrder) {
+				int x = tile.x0 + cell.x;
+				int y = tile.y0 + cell.y;
+				if (x < tile.x1 && y < tile.y1) {
+					glm::vec3 colour = baseColours[y * width + x];
+					if (onEdge(x, y)) {
+						// Running sum and sum of squares of the samples, to
+						// estimate how noisy the pixel's mean still is
+						glm::vec3 sum = colour;
+						glm::vec3 sumSquares = colour * colour;
+						int n = 1;
+						for (int sample = 0; n < samples; sample++) {
+							glm::vec3 c = raytraceSingleRay(scene, sampleRay(x, y, sample), RENDER_MAX_DEPTH, -1, settings);
+							sum += c;
+							sumSquares += c * c;
+							n++;
+							if (n >= ADAPTIVE_MIN_SAMPLES) {
+								glm::vec3 mean = sum / float(n);
+								glm::vec3 variance = sumSquares / float(n) - mean * mean;
+								float errorOfMean = glm::max(variance.r, glm::max(variance.g, variance.b)) / n;
+								if (errorOfMean < threshold * threshold) {
+									break;
+								}
+							}
+						}
+						colour = sum / float(n);
+						tileSamples += n - 1;
+						refined = true;
+					}
+					colours[(y - tile.y0) * tile.width() + (x - tile.x0)] = colour;
+				}
+			}
+			adaptiveSamples += tileSamples;
+			if (refined) {
+				image.SetPixels(tile.x0, tile.y0, tile.width(), tile.height(), colours.data());
+			}
+		}, settings.pixelOrder);
+	}
+
+	if (cancelled()) {
+		return false;
+	}
+	if (primaryHits) {
+		primaryHits->valid = true;
+	}
+	if (dependencies) {
+		dependencies->valid = true;
+	}
+	uint64_t pixels = uint64_t(image.Width()) * image.Height();
+	if (onlyTiles) {
+		Log::info("Traced {} of {} tiles again", tracedTiles.load(), onlyTiles->size());
+	}
+	if (adaptive) {
+		Log::info("Adaptive sampling: {:.2f} rays per pixel on average (budget {})", double(pixels + adaptiveSamples.load()) / pixels, samples);
+	}
+	if (allocationCountingEnabled()) {
+		Log::info("Heap allocations while tracing {} camera rays: {}", pixels * passSamples, tracingAllocations.load());
+	}
+	return true;
+}
+
+} // namespace
+
+bool raytraceImage(Scene const &scene, Framebuffer &image, glm::vec3 viewPoint, TileScheduler &scheduler, RenderSettings const &settings, std::atomic<bool> const *cancel, GBuffer *primaryHits, DependencyBuffer *dependencies) {
+	return traceImage(scene, image, viewPoint, scheduler, settings, cancel, primaryHits, dependencies, nullptr);
+}
+
+bool rerenderShapes(Scene const &scene, Scene const &oldScene, std::vector<int> const &changedShapes, Framebuffer &image, TileScheduler &scheduler, DependencyBuffer &dependencies, RenderSettings const &settings, std::atomic<bool> const *cancel, GBuffer *primaryHits) {
+	bool narrowable = dependencies.valid && dependencies.width == image.Width() && dependencies.height == image.Height()
+		&& !settings.wavefront && !(settings.adaptiveSampling && settings.samplesPerPixel > 1);
+	if (!narrowable) {
+		return raytraceImage(scene, image, dependencies.viewPoint, scheduler, settings, cancel, primaryHits, &dependencies);
+	}
+
+	std::vector<bool> affected = tilesAffectedBy(dependencies, oldScene, scene, changedShapes);
+	bool traced = traceImage(scene, image, dependencies.viewPoint, scheduler, settings, cancel, primaryHits, &dependencies, &affected);
+
+	// A cancelled pass leaves some tiles showing the old scene, with nothing
+	// to tell which, so the next edit has to start over
+	if (!traced) {
+		dependencies.valid = false;
+	}
+	if (primaryHits && (!traced || settings.samplesPerPixel > 1)) {
+		primaryHits->valid = false;
+	}
+	return traced;
+}
+
+bool relightImage(Scene const &scene, GBuffer const &primaryHits, Framebuffer &image, TileScheduler &scheduler, RenderSettings const &settings, std::atomic<bool> const *cancel) {
+	if (!primaryHits.valid || primaryHits.width != image.Width() || primaryHits.height != image.Height()) {
+		Log::error("No camera hits to relight the image with, render it first");
+		return false;
+	}
+
+	auto cancelled = [cancel] {
+		return cancel && cancel->load(std::memory_order_relaxed);
+	};
+
+	// The camera rays are still needed for the view direction, just not traced
+	CameraRays camera(image.Width(), image.Height(), primaryHits.viewPoint);
+	std::vector<glm::ivec2> pixelOrder = traversalOrder(RENDER_TILE_SIZE, RENDER_TILE_SIZE, settings.pixelOrder);
+
+	scheduler.run(image.Width(), image.Height(), RENDER_TILE_SIZE, [&](Tile const &tile, int) {
+		if (cancelled()) {
+			return;
+		}
+		std::vector<glm::vec3> colours(tile.width() * tile.height());
+		for (glm::ivec2 cell : pixelOrder) {
+			int x = tile.x0 + cell.x;
+			int y = tile.y0 + cell.y;
+			if (x < tile.x1 && y < tile.y1) {
+				colours[cell.y * tile.width() + cell.x] = shadeIntersection(scene, camera.ray(x, y), primaryHits.at(x, y), RENDER_MAX_DEPTH, settings);
+			}
+		}
+		image.SetPixels(tile.x0, tile.y0, tile.width(), tile.height(), colours.data());
+	}, settings.pixelOrder);
+
+	return !cancelled();
+}
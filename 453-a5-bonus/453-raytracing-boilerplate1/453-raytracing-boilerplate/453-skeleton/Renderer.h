@@ -0,0 +1,143 @@
+//------------------------------------------------------------------------------
+// The ray tracer itself: tracing single rays through a scene and rendering
+// a whole image with them.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+
+#include <glm/glm.hpp>
+
+#include "RayTrace.h"
+#include "Scene.h"
+#include "GBuffer.h"
+#include "ShapeDependencies.h"
+#include "TileScheduler.h"
+#include "TraversalOrder.h"
+#include "Framebuffer.h"
+
+// Size (in pixels) of the square tiles that the image is split into
+const int RENDER_TILE_SIZE = 16;
+
+// Maximum number of reflection / refraction bounces per camera ray
+const int RENDER_MAX_DEPTH = 5;
+
+// Fewest rays a pixel picked by adaptive sampling gets, before its noise is
+// looked at (one sample says nothing about noise, two or three not much)
+const int ADAPTIVE_MIN_SAMPLES = 4;
+
+struct RenderSettings {
+	// Trace camera rays in 4x4 packets instead of one at a time. Reflection,
+	// refraction and shadow rays are always traced one at a time.
+	bool packets = true;
+
+	// Order in which tiles are handed out, and pixels or packets are traced
+	// within a tile (the wavefront renderer has its own order)
+	TraversalOrder pixelOrder = TraversalOrder::Tiled;
+
+	// If more than 1, start with a quick pass that traces one ray per block
+	// of previewBlockSize x previewBlockSize pixels, so a rough image shows
+	// up long before the full one is done.
+	int previewBlockSize = 0;
+
+	// Camera rays per pixel. With more than one, each pixel averages rays
+	// spread over its area (on a Halton pattern) to smooth out jagged edges.
+	// With adaptive sampling this is the most any one pixel gets.
+	int samplesPerPixel = 1;
+
+	// Trace one ray per pixel first, and only spend more on pixels that hit
+	// a different shape than a neighbour, or differ from it in colour by more
+	// than adaptiveThreshold (in any channel, from 0 to 1). Those stop getting
+	// rays once the noise in their average drops below the threshold too.
+	bool adaptiveSampling = false;
+	float adaptiveThreshold = 0.05f;
+
+	// Reflection and refraction rays that would add less than this much to
+	// any colour channel of the pixel aren't traced. The default is below
+	// what an 8 bit image can show.
+	float minThroughput = 1.0f / 256.0f;
+
+	// Instead of always dropping those rays, keep one now and then (with a
+	// chance of its throughput / minThroughput) and weigh it up to make up
+	// for the others, so that on average nothing is lost.
+	bool russianRoulette = false;
+
+	// Trace the image a stage at a time over big batches of rays, instead of
+	// a pixel at a time (see Wavefront.h). Adaptive sampling doesn't apply.
+	bool wavefront = false;
+
+	// In wavefront mode, sort the reflection and refraction rays by direction
+	// and origin before each round of extend (see Wavefront.cpp, rayKey)
+	bool sortSecondaryRays = false;
+};
+
+// True if anything other than shape skipID blocks the ray before tMax. Used
+// for shadow rays, it stops at the first hit it finds.
+bool occluded(Scene const &scene, Ray const &ray, float tMax, int skipID);
+// Closest hit along the ray, ignoring shape skipID. Only t and the primitive
+// are known at this point; resolveHit fills in the rest for shading.
+Hit getClosestHit(Scene const &scene, Ray const &ray, int skipID);
+Intersection resolveHit(Scene const &scene, Ray const &ray, Hit const &hit);
+Intersection getClosestIntersection(Scene const &scene, Ray ray, int skipID);
+
+// Closest hit of every lane of `active` in the packet, written to hits[lane]
+void getClosestIntersections(Scene const &scene, RayPacket const &packet, uint32_t active, Intersection *hits);
+
+// Colour seen along the ray, given what the ray hit. Reflections and
+// refractions are followed for up to `level` bounces, as long as they still
+// carry settings.minThroughput of the colour. Every ray of the tree is
+// passed to dependencies, if given.
+glm::vec3 shadeIntersection(Scene const &scene, Ray const &ray, Intersection const &result, int level, RenderSettings const &settings = RenderSettings(), DependencyRecorder *dependencies = nullptr);
+glm::vec3 raytraceSingleRay(Scene const &scene, Ray const &ray, int level, int source_id, RenderSettings const &settings = RenderSettings());
+
+// What happens to a ray at the surface it hit: the colour it picks up there,
+// which depends on whether the light can be seen, and the reflection and
+// refraction rays it carries on as.
+struct SurfaceScatter {
+	Ray shadowRay;        // towards the light; lit if nothing is hit before lightDistance
+	float lightDistance;
+	glm::vec3 litColor;      // Phong colour if lit
+	glm::vec3 shadowedColor; // ambient only if not
+	float localShare;     // how much of the ray's colour the surface itself makes up
+
+	int rayCount;         // refraction (if any) first, then reflection (if any)
+	Ray rays[2];
+	float shares[2];      // how much of the ray's colour each of them makes up
+};
+
+// Works out the above for a ray and the hit (which has to be found) it made
+void scatterAt(Scene const &scene, Ray const &ray, Intersection const &result, SurfaceScatter &scatter);
+
+// Whether a reflection / refraction ray carrying `weight` of a pixel's colour
+// is worth tracing, see RenderSettings::minThroughput. Russian roulette may
+// raise the weight of a ray it keeps.
+bool keepRay(Ray const &ray, glm::vec3 &weight, RenderSettings const &settings);
+
+// Renders the scene into the image, spreading the tiles of the image over all
+// of the scheduler's threads. Blocks until the image is complete, or until
+// *cancel is set: tiles that haven't been started by then are skipped (see
+// RenderJob). Returns true if the whole image was traced.
+//
+// The image has to be sized first. Finished tiles are marked as modified in
+// it, so a viewer can show them (ImageBuffer::Render uploads them) while the
+// rest of the image is still being traced on another thread.
+//
+// If primaryHits is given, it is filled in with what each camera ray hit, for
+// relightImage (only with one ray per pixel, and not in wavefront mode).
+// Likewise dependencies, for rerenderShapes (not with adaptive sampling, and
+// not in wavefront mode).
+bool raytraceImage(Scene const &scene, Framebuffer &image, glm::vec3 viewPoint, TileScheduler &scheduler, RenderSettings const &settings = RenderSettings(), std::atomic<bool> const *cancel = nullptr, GBuffer *primaryHits = nullptr, DependencyBuffer *dependencies = nullptr);
+
+// Brings an image of oldScene up to date with scene, where only the shapes in
+// changedShapes were edited (see tilesAffectedBy), by tracing just the tiles
+// that depended on them. The image, primaryHits and dependencies have to come
+// from the last render; if the dependencies can't narrow it down, this is
+// raytraceImage from the same view point. Same threading and cancelling as
+// raytraceImage.
+bool rerenderShapes(Scene const &scene, Scene const &oldScene, std::vector<int> const &changedShapes, Framebuffer &image, TileScheduler &scheduler, DependencyBuffer &dependencies, RenderSettings const &settings = RenderSettings(), std::atomic<bool> const *cancel = nullptr, GBuffer *primaryHits = nullptr);
+
+// Renders the image again from the camera hits of an earlier raytraceImage,
+// after the scene's light or materials changed. Only shading, shadow rays and
+// reflections / refractions are traced. Same threading and cancelling as
+// raytraceImage.
+bool relightImage(Scene const &scene, GBuffer const &primaryHits, Framebuffer &image, TileScheduler &scheduler, RenderSettings const &settings = RenderSettings(), std::atomic<bool> const *cancel = nullptr);
@@ -4,6 +4,10 @@
 
 #include <algorithm> // For std::max
 #include <limits> // For std::numeric_limits
+#include <random>
+
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 
 // Some constants defining the various scenes
 
@@ -251,6 +255,70 @@ vec3 back_wall2[]{
 		vec3(-10, -1, -12)
 };
 
+void buildSceneBVH(Scene &scene) {
+	auto accel = std::make_shared<ShapeBuckets>();
+	for (int i = 0; i < static_cast<int>(scene.shapesInScene.size()); i++) {
+		scene.shapesInScene[i]->addTo(*accel, i);
+	}
+	accel->spheres.build(scene.structure);
+	accel->cylinders.build(scene.structure);
+	accel->meshes.build(scene.structure);
+	accel->instances.build(scene.structure);
+	scene.accel = accel;
+}
+
+bool updateSceneBVH(Scene &scene, std::vector<int> const &movedShapes) {
+	// Every moved shape adds its new slot to `moved`, and slotOf finds it
+	// there (a shape only ever has a slot in one bucket)
+	ShapeBuckets moved;
+	for (int shape : movedShapes) {
+		scene.shapesInScene[shape]->addTo(moved, shape);
+	}
+	std::vector<int> slotOf(scene.shapesInScene.size(), -1);
+	moved.forEachBucket([&](auto const &bucket) {
+		for (int j = 0; j < static_cast<int>(bucket.slots.size()); j++) {
+			slotOf[bucket.slots[j].shape] = j;
+		}
+	});
+	for (int j = 0; j < static_cast<int>(moved.planes.size()); j++) {
+		slotOf[moved.planes[j].shape] = j;
+	}
+
+	auto accel = std::make_shared<ShapeBuckets>(*scene.accel);
+	for (PlaneSlot &plane : accel->planes) {
+		if (slotOf[plane.shape] >= 0) {
+			plane = moved.planes[slotOf[plane.shape]];
+		}
+	}
+	bool rebuilt = accel->spheres.update(moved.spheres, slotOf);
+	rebuilt = accel->cylinders.update(moved.cylinders, slotOf) || rebuilt;
+	rebuilt = accel->meshes.update(moved.meshes, slotOf) || rebuilt;
+	rebuilt = accel->instances.update(moved.instances, slotOf) || rebuilt;
+	scene.accel = accel;
+	return rebuilt;
+}
+
+Scene sceneAtTime(Scene const &scene, float time) {
+	Scene next = scene;
+	std::vector<int> moved;
+	for (ShapeAnimation const &animation : scene.animations) {
+		next.shapesInScene[animation.shape] = animation.at(time);
+		moved.push_back(animation.shape);
+	}
+	if (!moved.empty()) {
+		updateSceneBVH(next, moved);
+	}
+	return next;
+}
+
+void buildMaterialTable(Scene &scene) {
+	scene.materials.assign(1, ObjectMaterial());
+	for (auto &shape : scene.shapesInScene) {
+		shape->materialIndex = static_cast<int>(scene.materials.size());
+		scene.materials.push_back(shape->material);
+	}
+}
+
 Scene initScene1() {
 	//Scene 1
 	Scene scene1;
@@ -319,6 +387,9 @@ Scene initScene1() {
 
 	scene1.lightColor = vec3(1,1,1);
 	scene1.ambientFactor = 0.1f;
+
+	buildMaterialTable(scene1);
+	buildSceneBVH(scene1);
 	return scene1;
 }
 
@@ -401,5 +472,166 @@ Scene initScene2() {
 	scene2.lightColor = vec3(1,1,1);
 	scene2.ambientFactor = 0.1f;
 
+	buildMaterialTable(scene2);
+	buildSceneBVH(scene2);
 	return scene2;
 }
+
+Scene initScene3() {
+	//Scene 3: an asteroid field, ASTEROID_COUNT instances of one icosahedron
+	Scene scene3;
+	std::shared_ptr<Triangles> rock = std::make_shared<Triangles>();
+	rock->initTriangles(20, icosahedron, 0);
+	vec3 rockCentre = vec3(-2, 0, -7); // of the icosahedron in scene 2
+	vec3 planetCentre = vec3(0, -0.5f, -10);
+
+	// Always the same field
+	std::mt19937 random(453);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	for (int i = 0; i < ASTEROID_COUNT; i++) {
+		vec3 position(-7.0f + 14.0f * unit(random), -3.0f + 7.0f * unit(random), -16.0f + 12.0f * unit(random));
+		vec3 axis = glm::normalize(vec3(unit(random), unit(random), unit(random)) - vec3(0.5f) + vec3(0.0f, 0.0f, 0.001f));
+		float angle = glm::two_pi<float>() * unit(random);
+		float size = 0.08f + 0.2f * unit(random);
+		float squash = 0.6f + 0.4f * unit(random);
+
+		// Every ASTEROID_MOVING_EVERY-th asteroid spins and goes round the
+		// planet, ASTEROID_ORBIT_SPEED radians a second
+		bool moving = i % ASTEROID_MOVING_EVERY == 0;
+		auto transformAt = [=](float time) {
+			float orbit = moving ? ASTEROID_ORBIT_SPEED * time : 0.0f;
+			float spin = moving ? 4.0f * ASTEROID_ORBIT_SPEED * time : 0.0f;
+			vec3 orbitPosition = planetCentre + vec3(glm::rotate(mat4(1.0f), orbit, vec3(0, 1, 0)) * vec4(position - planetCentre, 0.0f));
+			mat4 transform = glm::translate(mat4(1.0f), orbit == 0.0f ? position : orbitPosition);
+			transform = glm::rotate(transform, angle + spin, axis);
+			transform = glm::scale(transform, vec3(size, size * squash, size));
+			transform = glm::translate(transform, -rockCentre);
+			return mat4x3(transform);
+		};
+
+		std::shared_ptr<Instance> asteroid = std::make_shared<Instance>(rock, transformAt(0.0f), 100 + i);
+		float shade = 0.3f + 0.3f * unit(random);
+		asteroid->material.diffuse = vec3(shade, 0.85f * shade, 0.7f * shade);
+		asteroid->material.ambient = 0.5f * asteroid->material.diffuse;
+		if (moving) {
+			scene3.animations.push_back({ i, [=](float time) {
+				auto moved = std::make_shared<Instance>(*asteroid);
+				moved->setTransform(transformAt(time));
+				return std::shared_ptr<Shape>(moved);
+			} });
+		}
+		scene3.shapesInScene.push_back(asteroid);
+	}
+
+	// Reflective planet in the middle of it
+	std::shared_ptr<Sphere> planet = std::make_shared<Sphere>(planetCentre, 2.0f, 1);
+	planet->material.diffuse = vec3(0.2, 0.3, 0.6);
+	planet->material.specular = vec3(0.8);
+	planet->material.specularCoefficient = 64;
+	planet->material.reflectionStrength = vec3(0.4);
+	scene3.shapesInScene.push_back(planet);
+
+	//Back wall
+	std::shared_ptr<Plane> backWall = std::make_shared<Plane>(vec3(0, 0, -20), vec3(0, 0, 1), 2);
+	backWall->material.diffuse = vec3(0.05, 0.05, 0.1);
+	backWall->material.ambient = backWall->material.diffuse;
+	scene3.shapesInScene.push_back(backWall);
+
+	scene3.lightPosition = vec3(4, 6, -1);
+	scene3.lightColor = vec3(1,1,1);
+	scene3.ambientFactor = 0.1f;
+
+	buildMaterialTable(scene3);
+	buildSceneBVH(scene3);
+	return scene3;
+}
+
+Scene initScene4() {
+	//Scene 4: PARTICLE_COUNT spheres, each bobbing about its own spot
+	Scene scene4;
+	scene4.structure = AccelStructure::Grid;
+
+	std::mt19937 random(453);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	for (int i = 0; i < PARTICLE_COUNT; i++) {
+		vec3 home(-5.0f + 10.0f * unit(random), -2.5f + 5.5f * unit(random), -14.0f + 9.0f * unit(random));
+		vec3 amplitude = 0.1f + 0.3f * vec3(unit(random), unit(random), unit(random));
+		vec3 speed = 0.5f + 1.5f * vec3(unit(random), unit(random), unit(random));
+		vec3 phase = glm::two_pi<float>() * vec3(unit(random), unit(random), unit(random));
+		float size = 0.02f + 0.04f * unit(random);
+		auto centreAt = [=](float time) {
+			return home + amplitude * glm::sin(speed * time + phase);
+		};
+
+		std::shared_ptr<Sphere> particle = std::make_shared<Sphere>(centreAt(0.0f), size, 100 + i);
+		particle->material.diffuse = vec3(0.4f + 0.6f * unit(random), 0.3f + 0.5f * unit(random), 0.2f + 0.3f * unit(random));
+		particle->material.ambient = 0.5f * particle->material.diffuse;
+		particle->material.specular = vec3(0.5f);
+		particle->material.specularCoefficient = 32;
+		if (i % 16 == 0) {
+			particle->material.reflectionStrength = vec3(0.5f);
+		}
+		scene4.animations.push_back({ i, [=](float time) {
+			auto moved = std::make_shared<Sphere>(*particle);
+			moved->centre = centreAt(time);
+			return std::shared_ptr<Shape>(moved);
+		} });
+		scene4.shapesInScene.push_back(particle);
+	}
+
+	//Floor
+	std::shared_ptr<Plane> ground = std::make_shared<Plane>(vec3(0, -3, 0), vec3(0, 1, 0), 1);
+	ground->material.diffuse = vec3(0.5, 0.5, 0.5);
+	ground->material.ambient = 0.5f * ground->material.diffuse;
+	ground->material.reflectionStrength = vec3(0.2);
+	scene4.shapesInScene.push_back(ground);
+
+	//Back wall
+	std::shared_ptr<Plane> backWall = std::make_shared<Plane>(vec3(0, 0, -16), vec3(0, 0, 1), 2);
+	backWall->material.diffuse = vec3(0.05, 0.05, 0.1);
+	backWall->material.ambient = backWall->material.diffuse;
+	scene4.shapesInScene.push_back(backWall);
+
+	scene4.lightPosition = vec3(4, 6, -1);
+	scene4.lightColor = vec3(1,1,1);
+	scene4.ambientFactor = 0.1f;
+
+	buildMaterialTable(scene4);
+	buildSceneBVH(scene4);
+	return scene4;
+}
+
+Scene initMeshScene(std::shared_ptr<const Triangles> mesh) {
+	Scene scene;
+
+	// Fit the mesh into a 4 unit box in front of the camera
+	AABB box = mesh->bounds();
+	vec3 extent = box.extent();
+	float size = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f));
+	vec3 centre = vec3(0, -0.5f, -7);
+	mat4 transform = glm::translate(mat4(1.0f), centre);
+	transform = glm::scale(transform, vec3(4.0f / size));
+	transform = glm::translate(transform, -box.centre());
+
+	std::shared_ptr<Instance> model = std::make_shared<Instance>(mesh, mat4x3(transform), 1);
+	model->material.diffuse = vec3(0.7, 0.7, 0.75);
+	model->material.ambient = 0.3f * model->material.diffuse;
+	model->material.specular = vec3(0.4);
+	model->material.specularCoefficient = 32;
+	scene.shapesInScene.push_back(model);
+
+	//Floor, just under the mesh
+	std::shared_ptr<Plane> ground = std::make_shared<Plane>(vec3(0, centre.y - 2.0f * extent.y / size, 0), vec3(0, 1, 0), 2);
+	ground->material.diffuse = vec3(0.5, 0.5, 0.5);
+	ground->material.ambient = 0.5f * ground->material.diffuse;
+	ground->material.reflectionStrength = vec3(0.2);
+	scene.shapesInScene.push_back(ground);
+
+	scene.lightPosition = vec3(4, 6, -1);
+	scene.lightColor = vec3(1,1,1);
+	scene.ambientFactor = 0.1f;
+
+	buildMaterialTable(scene);
+	buildSceneBVH(scene);
+	return scene;
+}
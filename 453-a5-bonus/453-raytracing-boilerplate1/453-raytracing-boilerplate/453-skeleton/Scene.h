@@ -5,18 +5,76 @@
 #pragma once
 
 #include "RayTrace.h"
+#include "ShapeBuckets.h"
+#include <functional>
 #include <memory>
 
 class Shape;
 
+// A shape that moves: at(time) makes a copy of the shape as it is at that time
+// (copies, since scenes share their shapes and an older scene may still be
+// rendering the old one). The copy keeps the shape's materialIndex.
+struct ShapeAnimation {
+	int shape; // index into Scene::shapesInScene
+	std::function<std::shared_ptr<Shape>(float time)> at;
+};
+
 struct Scene {
 	glm::vec3 lightPosition;
 	glm::vec3 lightColor;
 	float ambientFactor;
 	std::vector<std::shared_ptr<Shape>> shapesInScene;
+
+	// Materials of the shapes, see buildMaterialTable. materials[0] is the
+	// (black) default material that rays which hit nothing end up with.
+	std::vector<ObjectMaterial> materials{ ObjectMaterial() };
+
+	std::shared_ptr<const ShapeBuckets> accel;
+	// What buildSceneBVH puts over the shapes. BVHs trace faster, grids are
+	// quicker to build again when most of the scene moves every frame.
+	AccelStructure structure = AccelStructure::BVH;
+
+	// What moves in the scene, see sceneAtTime
+	std::vector<ShapeAnimation> animations;
 };
 
+// (Re)builds scene.accel from shapesInScene, with scene.structure over the
+// shapes. Call this after adding or moving shapes, or changing the structure.
+void buildSceneBVH(Scene &scene);
+
+// Brings scene.accel up to date after the shapes in movedShapes (indices into
+// shapesInScene) moved or were replaced, without building it from scratch:
+// their slots are swapped in and the BVHs refitted, and a BVH is only built
+// again once refitting has made it too slow (see BVH_REBUILD_COST_RATIO).
+// Grids are always built again.
+// Nothing may have been added or removed. The old accel isn't touched, so
+// older copies of the scene can still be rendered. Returns true if a BVH was
+// built again.
+bool updateSceneBVH(Scene &scene, std::vector<int> const &movedShapes);
+
+// The scene at the given time: every animated shape is replaced by the
+// animation's copy for that time, and the BVH is updated with updateSceneBVH.
+Scene sceneAtTime(Scene const &scene, float time);
+
+// Copies the material of every shape into scene.materials and points the shape
+// at it. Call this after adding shapes or changing their materials.
+void buildMaterialTable(Scene &scene);
 
 Scene initScene1();
 Scene initScene2();
 
+// Lots of instances of one mesh (see Instance), around a sphere. Some of them
+// are animated.
+const int ASTEROID_COUNT = 1000;
+const int ASTEROID_MOVING_EVERY = 10;
+const float ASTEROID_ORBIT_SPEED = 0.2f;
+Scene initScene3();
+
+// A cloud of small spheres that all move all the time, over a uniform grid
+const int PARTICLE_COUNT = 20000;
+Scene initScene4();
+
+// One mesh (e.g. from a mesh file, see MeshFile.h) on a floor, scaled and
+// moved to fill the view
+Scene initMeshScene(std::shared_ptr<const Triangles> mesh);
+
@@ -0,0 +1,508 @@
+//------------------------------------------------------------------------------
+// The shapes of a scene, compiled into one flat array per kind of shape.
+//
+// Scenes are put together as a list of Shape objects, but walking that list
+// costs a pointer chase and a virtual call per shape per ray. buildSceneBVH
+// asks every shape to add a small copy of its geometry (a "slot") to the array
+// for its kind instead. Each array has its own BVH and is stored in that BVH's
+// leaf order, so the loops over a leaf know exactly what they are testing and
+// the ray tests below get inlined into them.
+//
+// Instead of BVHs, the buckets can also use uniform grids (see
+// AccelStructure), which are quicker to build but usually slower to trace.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "BVH.h"
+#include "Ray.h"
+#include "RayPacket.h"
+#include "RayTrace.h"
+#include "UniformGrid.h"
+
+// Every slot remembers which shape it came from: `shape` is its index in
+// Scene::shapesInScene and `id` is Shape::id (for skipping a shape).
+struct SphereSlot {
+	glm::vec3 centre;
+	float radius;
+	int shape;
+	int id;
+};
+
+struct CylinderSlot {
+	glm::vec3 center;
+	float radius;
+	float halfHeight;
+	glm::mat3 orientationInv; // world space to local
+	int shape;
+	int id;
+};
+
+struct PlaneSlot {
+	glm::vec3 point;
+	glm::vec3 normal;
+	int shape;
+	int id;
+};
+
+// Meshes already keep their triangles in flat arrays, so the slot just points
+// at the mesh (which is owned by Scene::shapesInScene).
+struct MeshSlot {
+	Triangles const *mesh;
+	int shape;
+	int id;
+};
+
+// Instances point at their (shared) mesh too, and add the transform into its
+// space. Triangles::intersect then walks the mesh's own BVH, so the scene's
+// BVH over the instances and the meshes' BVHs make up two levels.
+struct InstanceSlot {
+	Triangles const *mesh;
+	glm::mat3 linearInv; // world space to the mesh's
+	glm::vec3 translationInv;
+	int shape;
+	int id;
+};
+
+// -----------------------------------------------------------------------------
+// Ray tests for each kind of slot. The Shape classes use these as well.
+//
+// intersectSlot: closest hit search, lowers hit.t if the ray hits the slot at
+//                some 0 < t < hit.t (hit.shape is left to the caller).
+// occludedSlot:  any hit with OCCLUSION_T_MIN < t < tMax.
+
+inline bool intersectSlot(SphereSlot const &s, Ray const &ray, Hit &hit) {
+	glm::vec3 oc = ray.origin - s.centre;
+
+	float a = glm::dot(ray.direction, ray.direction);
+	float b = 2.0f * glm::dot(oc, ray.direction);
+	float c = glm::dot(oc, oc) - s.radius * s.radius;
+	float discriminant = b * b - 4 * a * c;
+	if (discriminant < 0) {
+		return false;
+	}
+
+	float root = std::sqrt(discriminant);
+	float t1 = (-b - root) / (2.0f * a);
+	float t2 = (-b + root) / (2.0f * a);
+	float t = (t1 > 0) ? t1 : t2;
+	if (t <= 0 || t >= hit.t) {
+		return false;
+	}
+	hit.t = t;
+	return true;
+}
+
+inline bool occludedSlot(SphereSlot const &s, Ray const &ray, float tMax) {
+	glm::vec3 oc = ray.origin - s.centre;
+	float a = glm::dot(ray.direction, ray.direction);
+	float b = 2.0f * glm::dot(oc, ray.direction);
+	float c = glm::dot(oc, oc) - s.radius * s.radius;
+	float discriminant = b * b - 4 * a * c;
+	if (discriminant < 0) {
+		return false;
+	}
+	float root = std::sqrt(discriminant);
+	float t1 = (-b - root) / (2.0f * a);
+	float t2 = (-b + root) / (2.0f * a);
+	return (t1 > OCCLUSION_T_MIN && t1 < tMax) || (t2 > OCCLUSION_T_MIN && t2 < tMax);
+}
+
+// Solves for where the ray crosses the (infinite) wall of the cylinder, in the
+// cylinder's local space. Returns false if it never does.
+inline bool cylinderWallHits(CylinderSlot const &s, Ray const &ray, glm::vec3 &localOrigin, glm::vec3 &localDir, float &t1, float &t2) {
+	localOrigin = s.orientationInv * (ray.origin - s.center);
+	localDir = s.orientationInv * ray.direction;
+	float A = localDir.x * localDir.x + localDir.z * localDir.z;
+
+	//ray is parallel to cylinder's axis or no valid intersection
+	if (A < 1e-8) {
+		return false;
+	}
+	float B = 2.0f * (localDir.x * localOrigin.x + localDir.z * localOrigin.z);
+	float C = localOrigin.x * localOrigin.x + localOrigin.z * localOrigin.z - s.radius * s.radius;
+	float discriminant = B * B - 4 * A * C;
+	if (discriminant < 0) {
+		return false;
+	}
+	float root = std::sqrt(discriminant);
+	t1 = (-B - root) / (2.0f * A);
+	t2 = (-B + root) / (2.0f * A);
+	return true;
+}
+
+inline bool intersectSlot(CylinderSlot const &s, Ray const &ray, Hit &hit) {
+	glm::vec3 localOrigin, localDir;
+	float t1, t2;
+	if (!cylinderWallHits(s, ray, localOrigin, localDir, t1, t2)) {
+		return false;
+	}
+
+	// Take the nearer wall hit in front of the ray, unless it misses the
+	// height of the cylinder, then try the far one.
+	float t = (t1 > 0) ? t1 : t2;
+	float y = localOrigin.y + t * localDir.y;
+	if (y < -s.halfHeight || y > s.halfHeight) {
+		if (t != t1) {
+			return false;
+		}
+		t = t2;
+		y = localOrigin.y + t * localDir.y;
+		if (y < -s.halfHeight || y > s.halfHeight) {
+			return false;
+		}
+	}
+
+	if (t <= 0 || t >= hit.t) {
+		return false;
+	}
+	hit.t = t;
+	return true;
+}
+
+inline bool occludedSlot(CylinderSlot const &s, Ray const &ray, float tMax) {
+	glm::vec3 localOrigin, localDir;
+	float t1, t2;
+	if (!cylinderWallHits(s, ray, localOrigin, localDir, t1, t2)) {
+		return false;
+	}
+
+	// Either wall hit counts, as long as it's in the interval and between the caps
+	for (float t : { t1, t2 }) {
+		float y = localOrigin.y + t * localDir.y;
+		if (t > OCCLUSION_T_MIN && t < tMax && y >= -s.halfHeight && y <= s.halfHeight) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Only the front of a plane is hit
+inline bool intersectSlot(PlaneSlot const &s, Ray const &ray, Hit &hit) {
+	float denominator = glm::dot(s.normal, ray.direction);
+	if (denominator >= 0) {
+		return false;
+	}
+	float t = glm::dot(s.point - ray.origin, s.normal) / denominator;
+	if (t <= 0 || t >= hit.t) {
+		return false;
+	}
+	hit.t = t;
+	return true;
+}
+
+inline bool occludedSlot(PlaneSlot const &s, Ray const &ray, float tMax) {
+	float denominator = glm::dot(s.normal, ray.direction);
+	if (denominator >= 0) {
+		return false;
+	}
+	float t = glm::dot(s.point - ray.origin, s.normal) / denominator;
+	return t > OCCLUSION_T_MIN && t < tMax;
+}
+
+// Meshes do their own BVH traversal. The qualified calls skip the vtable.
+inline bool intersectSlot(MeshSlot const &s, Ray const &ray, Hit &hit) {
+	return s.mesh->Triangles::intersect(ray, hit);
+}
+
+inline bool occludedSlot(MeshSlot const &s, Ray const &ray, float tMax) {
+	return s.mesh->Triangles::occluded(ray, tMax);
+}
+
+// The ray in the instance's mesh space. The direction isn't normalised, so
+// that t is the same along both rays and hits compare with the others.
+inline Ray instanceRay(InstanceSlot const &s, Ray const &ray) {
+	return Ray(s.linearInv * ray.origin + s.translationInv, s.linearInv * ray.direction);
+}
+
+inline bool intersectSlot(InstanceSlot const &s, Ray const &ray, Hit &hit) {
+	return s.mesh->Triangles::intersect(instanceRay(s, ray), hit);
+}
+
+inline bool occludedSlot(InstanceSlot const &s, Ray const &ray, float tMax) {
+	return s.mesh->Triangles::occluded(instanceRay(s, ray), tMax);
+}
+
+// Packet versions, returning the lanes whose hit was lowered. Meshes (and
+// instances of them) trace the packet through their BVH together, everything
+// else goes lane by lane.
+template <typename Slot>
+uint32_t intersectSlotPacket(Slot const &s, RayPacket const &packet, uint32_t active, Hit *hits) {
+	uint32_t closer = 0;
+	forEachLane(active, [&](int lane) {
+		if (intersectSlot(s, packet.ray(lane), hits[lane])) {
+			closer |= 1u << lane;
+		}
+	});
+	return closer;
+}
+
+inline uint32_t intersectSlotPacket(MeshSlot const &s, RayPacket const &packet, uint32_t active, Hit *hits) {
+	return s.mesh->Triangles::intersectPacket(packet, active, hits);
+}
+
+inline uint32_t intersectSlotPacket(InstanceSlot const &s, RayPacket const &packet, uint32_t active, Hit *hits) {
+	RayPacket local;
+	for (int lane = 0; lane < RayPacket::SIZE; lane++) {
+		local.set(lane, instanceRay(s, packet.ray(lane)));
+	}
+	return s.mesh->Triangles::intersectPacket(local, active, hits);
+}
+
+// -----------------------------------------------------------------------------
+
+// What each bucket puts over its slots
+enum class AccelStructure {
+	BVH,  // refitted when shapes move, and only built again once that has made it slow
+	Grid, // built again whenever anything moves, see UniformGrid.h
+};
+
+inline char const *accelStructureName(AccelStructure structure) {
+	return structure == AccelStructure::Grid ? "grid" : "bvh";
+}
+
+// Reads "bvh" or "grid". Returns false for anything else.
+inline bool parseAccelStructure(std::string const &name, AccelStructure &structure) {
+	for (AccelStructure s : { AccelStructure::BVH, AccelStructure::Grid }) {
+		if (name == accelStructureName(s)) {
+			structure = s;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Once refitting has made a bucket's BVH this many times as costly to trace
+// (BVH::sahCost) as it was when it was built, it is built again
+const float BVH_REBUILD_COST_RATIO = 1.2f;
+
+// All the slots of one kind, with a BVH or a grid over them
+template <typename Slot>
+struct ShapeBucket {
+	std::vector<Slot> slots;   // in BVH leaf order once built with a BVH
+	std::vector<AABB> bounds;  // of each slot, in the same order
+	AccelStructure structure = AccelStructure::BVH;
+	BVH bvh;                   // only built for AccelStructure::BVH
+	UniformGrid grid;          // only built for AccelStructure::Grid
+	float builtCost = 0.0f;    // bvh.sahCost() right after build()
+
+	void add(Slot const &slot, AABB const &slotBounds) {
+		slots.push_back(slot);
+		bounds.push_back(slotBounds);
+	}
+
+	// Builds the BVH and puts the slots in its leaf order, or builds the grid
+	void build(AccelStructure s);
+
+	// Puts in the new slots of the shapes in `moved` (which has a slot for
+	// each shape that moved, in any order), and refits the BVH to them, or
+	// builds it again if refitting makes it worse than BVH_REBUILD_COST_RATIO
+	// allows. A grid is simply built again. slotOf[shape] is the slot of the
+	// shape in `moved`, or -1. Returns true if the BVH was built again.
+	bool update(ShapeBucket const &moved, std::vector<int> const &slotOf);
+
+	void intersect(Ray const &ray, int skipID, Hit &hit) const;
+	bool occluded(Ray const &ray, float tMax, int skipID) const;
+	void intersectPacket(RayPacket const &packet, uint32_t active, Hit *hits) const;
+};
+
+// Acceleration structure over the shapes of a scene. Once built it is never
+// modified, so copies of a Scene can share it.
+struct ShapeBuckets {
+	ShapeBucket<SphereSlot> spheres;
+	ShapeBucket<CylinderSlot> cylinders;
+	ShapeBucket<MeshSlot> meshes;
+	ShapeBucket<InstanceSlot> instances;
+	std::vector<PlaneSlot> planes; // unbounded, every ray is tested against all of them
+
+	// Closest hit, sets hit.shape to the index of the shape in Scene::shapesInScene
+	void intersect(Ray const &ray, int skipID, Hit &hit) const;
+	bool occluded(Ray const &ray, float tMax, int skipID) const;
+	void intersectPacket(RayPacket const &packet, uint32_t active, Hit *hits) const;
+
+	// Calls fn(bucket) for each of the bounded buckets
+	template <typename F>
+	void forEachBucket(F &&fn) const {
+		fn(spheres);
+		fn(cylinders);
+		fn(meshes);
+		fn(instances);
+	}
+};
+
+// -----------------------------------------------------------------------------
+
+template <typename Slot>
+void ShapeBucket<Slot>::build(AccelStructure s) {
+	structure = s;
+	if (structure == AccelStructure::Grid) {
+		bvh = BVH();
+		grid.build(bounds);
+		builtCost = 0.0f;
+		return;
+	}
+	grid = UniformGrid();
+	bvh.build(bounds);
+	std::vector<Slot> orderedSlots;
+	std::vector<AABB> orderedBounds;
+	orderedSlots.reserve(slots.size());
+	orderedBounds.reserve(bounds.size());
+	for (int prim : bvh.primitives) {
+		orderedSlots.push_back(slots[prim]);
+		orderedBounds.push_back(bounds[prim]);
+	}
+	slots.swap(orderedSlots);
+	bounds.swap(orderedBounds);
+	builtCost = bvh.sahCost();
+}
+
+template <typename Slot>
+bool ShapeBucket<Slot>::update(ShapeBucket const &moved, std::vector<int> const &slotOf) {
+	bool changed = false;
+	for (size_t i = 0; i < slots.size(); i++) {
+		int j = slotOf[slots[i].shape];
+		if (j >= 0) {
+			slots[i] = moved.slots[j];
+			bounds[i] = moved.bounds[j];
+			changed = true;
+		}
+	}
+	if (!changed) {
+		return false;
+	}
+	if (structure == AccelStructure::Grid) {
+		grid.build(bounds);
+		return false;
+	}
+	bvh.refit(bounds);
+	if (bvh.sahCost() > BVH_REBUILD_COST_RATIO * builtCost) {
+		build(structure);
+		return true;
+	}
+	return false;
+}
+
+template <typename Slot>
+void ShapeBucket<Slot>::intersect(Ray const &ray, int skipID, Hit &hit) const {
+	auto intersectOne = [&](int i) {
+		Slot const &slot = slots[i];
+		if (slot.id != skipID && intersectSlot(slot, ray, hit)) {
+			hit.shape = slot.shape;
+		}
+	};
+	float tMax = hit.t;
+	if (structure == AccelStructure::Grid) {
+		grid.traverse(ray, tMax, [&](int const *cell, int count, float &tMax) {
+			for (int k = 0; k < count; k++) {
+				intersectOne(cell[k]);
+			}
+			tMax = hit.t;
+		});
+		return;
+	}
+	bvh.traverseLeaves(ray, tMax, [&](BVHNode const &leaf, float &tMax) {
+		for (int i = leaf.first; i < leaf.first + leaf.count; i++) {
+			intersectOne(i);
+		}
+		tMax = hit.t;
+	});
+}
+
+template <typename Slot>
+bool ShapeBucket<Slot>::occluded(Ray const &ray, float tMax, int skipID) const {
+	auto occludedBy = [&](int i) {
+		return slots[i].id != skipID && occludedSlot(slots[i], ray, tMax);
+	};
+	if (structure == AccelStructure::Grid) {
+		return grid.traverseAny(ray, tMax, [&](int const *cell, int count) {
+			for (int k = 0; k < count; k++) {
+				if (occludedBy(cell[k])) {
+					return true;
+				}
+			}
+			return false;
+		});
+	}
+	return bvh.traverseLeavesAny(ray, tMax, [&](BVHNode const &leaf) {
+		for (int i = leaf.first; i < leaf.first + leaf.count; i++) {
+			if (occludedBy(i)) {
+				return true;
+			}
+		}
+		return false;
+	});
+}
+
+template <typename Slot>
+void ShapeBucket<Slot>::intersectPacket(RayPacket const &packet, uint32_t active, Hit *hits) const {
+	float tMax[RayPacket::SIZE];
+	for (int lane = 0; lane < RayPacket::SIZE; lane++) {
+		tMax[lane] = hits[lane].t;
+	}
+	if (structure == AccelStructure::Grid) {
+		// The grid hands over one lane at a time, so there's nothing to gain
+		// from the packet versions of the slot tests
+		grid.traversePacket(packet, active, tMax, [&](int const *cell, int count, int lane) {
+			Ray ray = packet.ray(lane);
+			for (int k = 0; k < count; k++) {
+				Slot const &slot = slots[cell[k]];
+				if (intersectSlot(slot, ray, hits[lane])) {
+					hits[lane].shape = slot.shape;
+				}
+			}
+			tMax[lane] = hits[lane].t;
+		});
+		return;
+	}
+	bvh.traversePacket(packet, active, tMax, [&](BVHNode const &leaf, uint32_t lanes) {
+		for (int i = leaf.first; i < leaf.first + leaf.count; i++) {
+			uint32_t closer = intersectSlotPacket(slots[i], packet, lanes, hits);
+			forEachLane(closer, [&](int lane) {
+				hits[lane].shape = slots[i].shape;
+			});
+		}
+		forEachLane(lanes, [&](int lane) {
+			tMax[lane] = hits[lane].t;
+		});
+	});
+}
+
+inline void ShapeBuckets::intersect(Ray const &ray, int skipID, Hit &hit) const {
+	for (PlaneSlot const &plane : planes) {
+		if (plane.id != skipID && intersectSlot(plane, ray, hit)) {
+			hit.shape = plane.shape;
+		}
+	}
+	forEachBucket([&](auto const &bucket) {
+		bucket.intersect(ray, skipID, hit);
+	});
+}
+
+inline bool ShapeBuckets::occluded(Ray const &ray, float tMax, int skipID) const {
+	for (PlaneSlot const &plane : planes) {
+		if (plane.id != skipID && occludedSlot(plane, ray, tMax)) {
+			return true;
+		}
+	}
+	bool blocked = false;
+	forEachBucket([&](auto const &bucket) {
+		blocked = blocked || bucket.occluded(ray, tMax, skipID);
+	});
+	return blocked;
+}
+
+inline void ShapeBuckets::intersectPacket(RayPacket const &packet, uint32_t active, Hit *hits) const {
+	for (PlaneSlot const &plane : planes) {
+		uint32_t closer = intersectSlotPacket(plane, packet, active, hits);
+		forEachLane(closer, [&](int lane) {
+			hits[lane].shape = plane.shape;
+		});
+	}
+	forEachBucket([&](auto const &bucket) {
+		bucket.intersectPacket(packet, active, hits);
+	});
+}
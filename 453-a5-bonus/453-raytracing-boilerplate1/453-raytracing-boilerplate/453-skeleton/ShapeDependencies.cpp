@@ -0,0 +1,215 @@
+#include "ShapeDependencies.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+namespace {
+
+bool contains(AABB const &outer, AABB const &inner) {
+	return glm::all(glm::lessThanEqual(outer.min, inner.min)) && glm::all(glm::lessThanEqual(inner.max, outer.max));
+}
+
+// Calls visit(x, y, z) for every cell of a resolution^3 grid of unit cells
+// that the segment from p to q (in cells) passes through, from p's to q's.
+// It steps one cell wall at a time, always crossing the wall the segment
+// reaches first. Counting the steps rather than comparing positions means
+// rounding can't make it overshoot the last cell.
+template <typename F>
+void walkGrid(glm::vec3 p, glm::vec3 q, int resolution, F &&visit) {
+	glm::vec3 top(float(resolution - 1));
+	glm::ivec3 cell = glm::ivec3(glm::clamp(glm::floor(p), glm::vec3(0.0f), top));
+	glm::ivec3 last = glm::ivec3(glm::clamp(glm::floor(q), glm::vec3(0.0f), top));
+	glm::vec3 d = q - p;
+	const float inf = std::numeric_limits<float>::infinity();
+
+	// Per axis: which way it steps, how many steps are left, and where (as a
+	// fraction of the segment) it crosses the next wall. An axis with no
+	// steps left is never picked again.
+	int step[3], remaining[3];
+	float tNext[3], tDelta[3];
+	for (int axis = 0; axis < 3; axis++) {
+		step[axis] = last[axis] > cell[axis] ? 1 : -1;
+		remaining[axis] = std::abs(last[axis] - cell[axis]);
+		float wall = float(cell[axis] + (step[axis] > 0 ? 1 : 0));
+		tNext[axis] = remaining[axis] == 0 ? inf : d[axis] != 0.0f ? (wall - p[axis]) / d[axis] : std::numeric_limits<float>::max();
+		tDelta[axis] = d[axis] != 0.0f ? std::abs(1.0f / d[axis]) : 0.0f;
+	}
+
+	visit(cell.x, cell.y, cell.z);
+	for (int steps = remaining[0] + remaining[1] + remaining[2]; steps > 0; steps--) {
+		int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+		cell[axis] += step[axis];
+		tNext[axis] = --remaining[axis] == 0 ? inf : tNext[axis] + tDelta[axis];
+		visit(cell.x, cell.y, cell.z);
+	}
+}
+
+} // namespace
+
+void DependencyBuffer::reset(int w, int h, int size, glm::vec3 eye, Scene const &scene) {
+	width = w;
+	height = h;
+	tileSize = size;
+	tilesX = (w + size - 1) / size;
+	tilesY = (h + size - 1) / size;
+	viewPoint = eye;
+	shapeCount = static_cast<int>(scene.shapesInScene.size());
+
+	world = AABB();
+	for (auto const &shape : scene.shapesInScene) {
+		if (shape->hasBounds()) {
+			world.extend(shape->bounds());
+		}
+	}
+	world.extend(eye);
+	world.extend(scene.lightPosition);
+	glm::vec3 extent = world.extent();
+	for (int axis = 0; axis < 3; axis++) {
+		cellsPerUnit[axis] = extent[axis] > 0.0f ? DEPENDENCY_GRID_RESOLUTION / extent[axis] : 0.0f;
+	}
+	padding = 1e-4f * glm::max(glm::vec3(1.0f), glm::max(glm::abs(world.min), glm::abs(world.max)));
+
+	tiles.resize(tilesX * tilesY);
+	for (TileDependencies &t : tiles) {
+		t.clear(shapeCount);
+	}
+	valid = false;
+}
+
+bool DependencyRecorder::clip(glm::vec3 origin, glm::vec3 direction, float tEnd, glm::vec3 &from, glm::vec3 &to) const {
+	// Only the part inside the world counts, nothing that can move without
+	// tracing everything again is outside it
+	AABB const &world = buffer->world;
+	float tStart = 0.0f;
+	for (int axis = 0; axis < 3; axis++) {
+		float lo = world.min[axis] - buffer->padding[axis];
+		float hi = world.max[axis] + buffer->padding[axis];
+		if (direction[axis] != 0.0f) {
+			float t0 = (lo - origin[axis]) / direction[axis];
+			float t1 = (hi - origin[axis]) / direction[axis];
+			tStart = std::max(tStart, std::min(t0, t1));
+			tEnd = std::min(tEnd, std::max(t0, t1));
+		} else if (origin[axis] < lo || origin[axis] > hi) {
+			return false;
+		}
+	}
+	if (tStart > tEnd) {
+		return false;
+	}
+	from = tStart == 0.0f ? origin : origin + tStart * direction;
+	to = origin + tEnd * direction;
+	return true;
+}
+
+void DependencyRecorder::segment(glm::vec3 from, glm::vec3 to) {
+	walkGrid(buffer->gridPosition(from), buffer->gridPosition(to), DEPENDENCY_GRID_RESOLUTION, [&](int x, int y, int z) {
+		tile->addCell(DependencyBuffer::cellIndex(glm::ivec3(x, y, z)));
+	});
+}
+
+void DependencyRecorder::cone(glm::vec3 apex, glm::vec3 end, uint64_t *walked) {
+	glm::ivec3 cell = buffer->cellOf(end);
+	int index = DependencyBuffer::cellIndex(cell);
+	uint64_t bit = uint64_t(1) << (index % 64);
+	if (walked[index / 64] & bit) {
+		return;
+	}
+	walked[index / 64] |= bit;
+
+	// Every point of the cone is within half a cell (along each axis) of the
+	// segment from apex to the centre of the cell. So a cell is in it if
+	// that segment passes through the cell grown by half a cell on every
+	// side, and those grown cells overlap in twos along each axis: walking
+	// a grid shifted by half a cell, every cell of it stands for the 2 x 2 x 2
+	// cells around its centre.
+	glm::vec3 half(0.5f);
+	int last = DEPENDENCY_GRID_RESOLUTION - 1;
+	walkGrid(buffer->gridPosition(apex) + half, glm::vec3(cell) + half + half, DEPENDENCY_GRID_RESOLUTION + 1, [&](int x, int y, int z) {
+		for (int cz = std::max(z - 1, 0); cz <= std::min(z, last); cz++) {
+			for (int cy = std::max(y - 1, 0); cy <= std::min(y, last); cy++) {
+				for (int cx = std::max(x - 1, 0); cx <= std::min(x, last); cx++) {
+					tile->addCell(DependencyBuffer::cellIndex(glm::ivec3(cx, cy, cz)));
+				}
+			}
+		}
+	});
+}
+
+void DependencyRecorder::ray(Ray const &ray, Intersection const &hit) {
+	if (hit.found) {
+		tile->addShape(hit.shape);
+	}
+	glm::vec3 from, to;
+	if (hit.found ? !clip(ray.origin, hit.point - ray.origin, 1.0f, from, to) : !clip(ray.origin, ray.direction, std::numeric_limits<float>::infinity(), from, to)) {
+		return;
+	}
+	if (from == buffer->viewPoint) {
+		cone(from, to, fromEye);
+	} else {
+		segment(from, to);
+	}
+}
+
+void DependencyRecorder::shadowRay(Ray const &ray, glm::vec3 lightPosition) {
+	glm::vec3 from, to;
+	if (clip(ray.origin, lightPosition - ray.origin, 1.0f, from, to)) {
+		cone(lightPosition, from, fromLight);
+	}
+}
+
+std::vector<bool> tilesAffectedBy(DependencyBuffer const &dependencies, Scene const &oldScene, Scene const &newScene, std::vector<int> const &changedShapes) {
+	std::vector<bool> affected(dependencies.tiles.size(), false);
+	auto everything = [&] {
+		return std::vector<bool>(dependencies.tiles.size(), true);
+	};
+
+	int shapeCount = dependencies.shapeCount;
+	if (!dependencies.valid || oldScene.shapesInScene.size() != size_t(shapeCount) || newScene.shapesInScene.size() != size_t(shapeCount)) {
+		return everything();
+	}
+
+	for (int k : changedShapes) {
+		if (k < 0 || k >= shapeCount) {
+			continue;
+		}
+		Shape const &before = *oldScene.shapesInScene[k];
+		Shape const &after = *newScene.shapesInScene[k];
+
+		if (&before == &after) {
+			// Same geometry, so only where the shape was hit can change
+			for (size_t i = 0; i < affected.size(); i++) {
+				affected[i] = affected[i] || dependencies.tiles[i].dependsOn(k);
+			}
+			continue;
+		}
+
+		if (!before.hasBounds() || !after.hasBounds() || !contains(dependencies.world, after.bounds())) {
+			return everything();
+		}
+		// The cells either box overlaps. The boxes are grown a little, so a
+		// segment that rounding put in the cell next door still counts.
+		uint64_t touched[DEPENDENCY_GRID_WORDS] = {};
+		for (AABB bounds : { before.bounds(), after.bounds() }) {
+			glm::ivec3 lo = dependencies.cellOf(bounds.min - dependencies.padding);
+			glm::ivec3 hi = dependencies.cellOf(bounds.max + dependencies.padding);
+			for (int z = lo.z; z <= hi.z; z++) {
+				for (int y = lo.y; y <= hi.y; y++) {
+					for (int x = lo.x; x <= hi.x; x++) {
+						int c = DependencyBuffer::cellIndex(glm::ivec3(x, y, z));
+						touched[c / 64] |= uint64_t(1) << (c % 64);
+					}
+				}
+			}
+		}
+		for (size_t i = 0; i < affected.size(); i++) {
+			TileDependencies const &tile = dependencies.tiles[i];
+			bool crossed = false;
+			for (int w = 0; w < DEPENDENCY_GRID_WORDS && !crossed; w++) {
+				crossed = (tile.cells[w] & touched[w]) != 0;
+			}
+			affected[i] = affected[i] || tile.dependsOn(k) || crossed;
+		}
+	}
+	return affected;
+}
@@ -0,0 +1,135 @@
+//------------------------------------------------------------------------------
+// What every tile of an image depended on when it was traced, so that after
+// one shape is edited only the tiles that can have changed are traced again.
+//
+// Each tile keeps the set of shapes its ray trees hit (camera, reflection
+// and refraction rays), and which cells of a coarse grid over the world its
+// ray segments passed through, shadow rays included. A ray that misses
+// counts up to where it leaves the world (see DependencyBuffer::world). Then,
+// for an edit to shape k:
+//
+//   - a new material only changes the tiles that hit k
+//   - moving k only changes the tiles whose rays went through the cells of
+//     k's old bounds (they hit it, or it cast a shadow) or of its new bounds
+//     (it can now block, or be hit by, one of their rays)
+//
+// The cells are there because one box around all of a tile's segments won't
+// do: every camera ray starts at the eye and every shadow ray ends at the
+// light, so that box spans most of the scene for every tile. Those two kinds
+// are also most of the segments, so rather than walk each of them, a tile
+// marks the cells of the cone from the eye (or light) to each cell its
+// segments end (or start) in, once per cell. That covers every segment
+// between the two, and a tile's rays only end in a handful of cells.
+//
+// Both tests are conservative: a tile they pick may well come out the same,
+// but one they skip always does.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Ray.h"
+#include "RayTrace.h"
+#include "Scene.h"
+#include "TileScheduler.h"
+
+// Cells along each axis of the grid the tiles' ray segments are recorded in
+const int DEPENDENCY_GRID_RESOLUTION = 16;
+const int DEPENDENCY_GRID_WORDS = DEPENDENCY_GRID_RESOLUTION * DEPENDENCY_GRID_RESOLUTION * DEPENDENCY_GRID_RESOLUTION / 64;
+
+struct TileDependencies {
+	// Bit k is set if a ray of the tile hit Scene::shapesInScene[k]
+	std::vector<uint64_t> shapes;
+
+	// Bit c is set if one of the tile's ray segments passed through grid
+	// cell c (see DependencyBuffer::cellIndex)
+	uint64_t cells[DEPENDENCY_GRID_WORDS];
+
+	void clear(int shapeCount) {
+		shapes.assign((shapeCount + 63) / 64, 0);
+		std::fill(std::begin(cells), std::end(cells), 0);
+	}
+	void addShape(int shape) { shapes[shape / 64] |= uint64_t(1) << (shape % 64); }
+	bool dependsOn(int shape) const { return (shapes[shape / 64] >> (shape % 64)) & 1; }
+	void addCell(int cell) { cells[cell / 64] |= uint64_t(1) << (cell % 64); }
+};
+
+struct DependencyBuffer {
+	int width = 0;
+	int height = 0;
+	int tileSize = 0;
+	int tilesX = 0;
+	int tilesY = 0;
+	glm::vec3 viewPoint{ 0.0f };
+	int shapeCount = 0;
+
+	// The bounds of every shape that has any, the camera and the light. Rays
+	// that miss are only followed this far, so a shape that moves outside it
+	// means tracing the whole image again.
+	AABB world;
+	// Grid cells per unit along each axis, DEPENDENCY_GRID_RESOLUTION across the world
+	glm::vec3 cellsPerUnit{ 0.0f };
+	// How much segments and boxes are grown by, so rounding can't move
+	// something that touches a cell out of it
+	glm::vec3 padding{ 0.0f };
+
+	std::vector<TileDependencies> tiles;
+
+	// Set once a render has traced every tile. Only renders with the tiles of
+	// raytraceImage's full pass (not adaptive, not wavefront) fill it in.
+	bool valid = false;
+
+	void reset(int w, int h, int size, glm::vec3 eye, Scene const &scene);
+
+	TileDependencies &tile(Tile const &t) { return tiles[(t.y0 / tileSize) * tilesX + t.x0 / tileSize]; }
+	TileDependencies const &tile(Tile const &t) const { return tiles[(t.y0 / tileSize) * tilesX + t.x0 / tileSize]; }
+
+	// Where a point is on the grid, in cells from world.min
+	glm::vec3 gridPosition(glm::vec3 p) const { return (p - world.min) * cellsPerUnit; }
+	// The grid cell a point is in, clamped to the world
+	glm::ivec3 cellOf(glm::vec3 p) const {
+		glm::vec3 c = glm::floor(gridPosition(p));
+		return glm::ivec3(glm::clamp(c, glm::vec3(0.0f), glm::vec3(DEPENDENCY_GRID_RESOLUTION - 1)));
+	}
+	static int cellIndex(glm::ivec3 cell) { return (cell.z * DEPENDENCY_GRID_RESOLUTION + cell.y) * DEPENDENCY_GRID_RESOLUTION + cell.x; }
+};
+
+// Adds the ray segments of one tile's ray trees to its dependencies
+struct DependencyRecorder {
+	TileDependencies *tile;
+	DependencyBuffer const *buffer;
+
+	// Cells the cones from the eye and from the light have been marked for
+	uint64_t fromEye[DEPENDENCY_GRID_WORDS] = {};
+	uint64_t fromLight[DEPENDENCY_GRID_WORDS] = {};
+
+	// A ray and what it hit; a miss counts up to where it leaves the world
+	void ray(Ray const &ray, Intersection const &hit);
+	// A shadow ray, from its origin to the light
+	void shadowRay(Ray const &ray, glm::vec3 lightPosition);
+
+private:
+	// Clips origin + t * direction, 0 <= t <= tEnd, to the world. Returns
+	// false if none of it is inside.
+	bool clip(glm::vec3 origin, glm::vec3 direction, float tEnd, glm::vec3 &from, glm::vec3 &to) const;
+	// Marks the cells the segment passes through
+	void segment(glm::vec3 from, glm::vec3 to);
+	// Marks the cells of the cone from apex to the cell `end` is in, unless
+	// `walked` says that has been done already
+	void cone(glm::vec3 apex, glm::vec3 end, uint64_t *walked);
+};
+
+// Which tiles (in DependencyBuffer::tiles order) have to be traced again after
+// the shapes in changedShapes (indices into Scene::shapesInScene) changed
+// between oldScene and newScene. A shape that is the same object in both
+// scenes only changed its material; one that was replaced (scenes share
+// their shapes, so moving one means copying it) may also have moved.
+//
+// Every tile is marked if that can't be narrowed down: the dependencies are
+// out of date, shapes were added or removed, or a changed shape is unbounded
+// (a plane that moved) or moved outside the world.
+std::vector<bool> tilesAffectedBy(DependencyBuffer const &dependencies, Scene const &oldScene, Scene const &newScene, std::vector<int> const &changedShapes);
@@ -0,0 +1,128 @@
+#include "TileScheduler.h"
+
+#include <algorithm>
+
+TileScheduler::TileScheduler(int threadCount) {
+	if (threadCount <= 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	for (int i = 0; i < threadCount; i++) {
+		queues.push_back(std::make_unique<TileQueue>());
+	}
+
+	// Worker 0 is whichever thread calls run(), so we only need to spawn the rest.
+	for (int i = 1; i < threadCount; i++) {
+		threads.emplace_back(&TileScheduler::workerLoop, this, i);
+	}
+}
+
+TileScheduler::~TileScheduler() {
+	{
+		std::lock_guard<std::mutex> lk(jobLock);
+		shuttingDown = true;
+	}
+	jobStarted.notify_all();
+	for (auto &t : threads) {
+		t.join();
+	}
+}
+
+void TileScheduler::run(int width, int height, int tileSize, std::function<void(Tile const &, int)> const &renderTile, TraversalOrder order) {
+	std::lock_guard<std::mutex> running(runLock);
+
+	std::vector<Tile> tiles;
+	int tilesX = (width + tileSize - 1) / tileSize;
+	int tilesY = (height + tileSize - 1) / tileSize;
+	for (glm::ivec2 cell : traversalOrder(tilesX, tilesY, order)) {
+		int x = cell.x * tileSize;
+		int y = cell.y * tileSize;
+		tiles.push_back({ x, y, std::min(x + tileSize, width), std::min(y + tileSize, height) });
+	}
+
+	// Give each worker a contiguous block of tiles so that neighbouring tiles
+	// (which tend to hit the same objects) stay on the same core.
+	int workers = threadCount();
+	for (int w = 0; w < workers; w++) {
+		size_t begin = tiles.size() * w / workers;
+		size_t end = tiles.size() * (w + 1) / workers;
+		std::lock_guard<std::mutex> lk(queues[w]->lock);
+		queues[w]->tiles.assign(tiles.begin() + begin, tiles.begin() + end);
+	}
+
+	{
+		std::lock_guard<std::mutex> lk(jobLock);
+		job = &renderTile;
+		busyWorkers = workers - 1;
+		generation++;
+	}
+	jobStarted.notify_all();
+
+	work(0);
+
+	std::unique_lock<std::mutex> lk(jobLock);
+	jobFinished.wait(lk, [this] { return busyWorkers == 0; });
+	job = nullptr;
+}
+
+void TileScheduler::parallelFor(int count, int chunkSize, std::function<void(int, int, int)> const &body) {
+	// A row of count x 1 pixels, cut into tiles chunkSize wide
+	run(count, 1, chunkSize, [&](Tile const &tile, int worker) {
+		body(tile.x0, tile.x1, worker);
+	});
+}
+
+bool TileScheduler::popOwn(int worker, Tile &tile) {
+	TileQueue &q = *queues[worker];
+	std::lock_guard<std::mutex> lk(q.lock);
+	if (q.tiles.empty()) {
+		return false;
+	}
+	tile = q.tiles.front();
+	q.tiles.pop_front();
+	return true;
+}
+
+bool TileScheduler::steal(int worker, Tile &tile) {
+	int workers = threadCount();
+	for (int i = 1; i < workers; i++) {
+		TileQueue &q = *queues[(worker + i) % workers];
+		std::lock_guard<std::mutex> lk(q.lock);
+		if (!q.tiles.empty()) {
+			tile = q.tiles.back();
+			q.tiles.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+void TileScheduler::work(int worker) {
+	// Tiles are only ever added at the start of run(), so once every queue is
+	// empty there is nothing left for this worker to do.
+	Tile tile;
+	while (popOwn(worker, tile) || steal(worker, tile)) {
+		(*job)(tile, worker);
+	}
+}
+
+void TileScheduler::workerLoop(int worker) {
+	unsigned seen = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lk(jobLock);
+			jobStarted.wait(lk, [&] { return shuttingDown || generation != seen; });
+			if (shuttingDown) {
+				return;
+			}
+			seen = generation;
+		}
+
+		work(worker);
+
+		std::lock_guard<std::mutex> lk(jobLock);
+		if (--busyWorkers == 0) {
+			jobFinished.notify_all();
+		}
+	}
+}
@@ -0,0 +1,80 @@
+//------------------------------------------------------------------------------
+// A small thread pool that splits an image into tiles and hands them out to
+// worker threads.
+//
+// Every worker owns a queue of tiles. It takes tiles from the front of its own
+// queue and, once that runs dry, steals from the back of somebody else's. This
+// keeps all of the cores busy even when some parts of the image (reflective or
+// refractive objects) are much more expensive to trace than others.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "TraversalOrder.h"
+
+// A rectangular region of the image: [x0, x1) x [y0, y1)
+struct Tile {
+	int x0, y0;
+	int x1, y1;
+
+	int width() const { return x1 - x0; }
+	int height() const { return y1 - y0; }
+};
+
+class TileScheduler {
+public:
+	// A thread count of 0 uses every hardware thread on the machine.
+	explicit TileScheduler(int threadCount = 0);
+	~TileScheduler();
+
+	TileScheduler(TileScheduler const &) = delete;
+	TileScheduler &operator=(TileScheduler const &) = delete;
+
+	int threadCount() const { return static_cast<int>(queues.size()); }
+
+	// Splits a width x height image into tiles of tileSize x tileSize and calls
+	// renderTile once for each of them. The calling thread joins in on the work
+	// and this only returns once every tile is done.
+	//
+	// The worker index passed to renderTile is in [0, threadCount()) and can be
+	// used to index per-thread scratch data. Each worker starts on a run of
+	// tiles that are next to each other in the given order.
+	void run(int width, int height, int tileSize, std::function<void(Tile const &, int)> const &renderTile, TraversalOrder order = TraversalOrder::Tiled);
+
+	// Same thing for a loop over [0, count): calls body(begin, end, worker) for
+	// ranges of chunkSize indices (the last one may be shorter). begin is
+	// always a multiple of chunkSize.
+	void parallelFor(int count, int chunkSize, std::function<void(int, int, int)> const &body);
+
+private:
+	struct TileQueue {
+		std::mutex lock;
+		std::deque<Tile> tiles;
+	};
+
+	bool popOwn(int worker, Tile &tile);
+	bool steal(int worker, Tile &tile);
+	void work(int worker);
+	void workerLoop(int worker);
+
+	std::vector<std::unique_ptr<TileQueue>> queues;
+	std::vector<std::thread> threads;
+
+	// State of the job currently being run
+	std::function<void(Tile const &, int)> const *job = nullptr;
+
+	std::mutex runLock; // only one job runs at a time
+	std::mutex jobLock;
+	std::condition_variable jobStarted;
+	std::condition_variable jobFinished;
+	unsigned generation = 0;
+	int busyWorkers = 0;
+	bool shuttingDown = false;
+};
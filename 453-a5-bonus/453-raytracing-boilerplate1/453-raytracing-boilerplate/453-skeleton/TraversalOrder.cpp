@@ -0,0 +1,55 @@
+#include "TraversalOrder.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+#include "Morton.h"
+
+std::vector<glm::ivec2> traversalOrder(int width, int height, TraversalOrder order) {
+	// Hilbert indices need a square, power of 2 grid around the cells
+	uint32_t side = 1;
+	while (side < uint32_t(std::max(width, height))) {
+		side *= 2;
+	}
+
+	std::vector<std::pair<uint32_t, glm::ivec2>> keyed;
+	keyed.reserve(width * height);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			uint32_t key;
+			switch (order) {
+			case TraversalOrder::Morton: key = mortonCode2(x, y); break;
+			case TraversalOrder::Hilbert: key = hilbertIndex2(side, x, y); break;
+			default: key = y * width + x; break;
+			}
+			keyed.push_back({ key, glm::ivec2(x, y) });
+		}
+	}
+	std::sort(keyed.begin(), keyed.end(), [](auto const &a, auto const &b) { return a.first < b.first; });
+
+	std::vector<glm::ivec2> cells;
+	cells.reserve(keyed.size());
+	for (auto const &k : keyed) {
+		cells.push_back(k.second);
+	}
+	return cells;
+}
+
+char const *traversalOrderName(TraversalOrder order) {
+	switch (order) {
+	case TraversalOrder::Morton: return "morton";
+	case TraversalOrder::Hilbert: return "hilbert";
+	default: return "tiled";
+	}
+}
+
+bool parseTraversalOrder(std::string const &name, TraversalOrder &order) {
+	for (TraversalOrder o : { TraversalOrder::Tiled, TraversalOrder::Morton, TraversalOrder::Hilbert }) {
+		if (name == traversalOrderName(o)) {
+			order = o;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,27 @@
+//------------------------------------------------------------------------------
+// The order in which the tiles of an image are handed out, and in which the
+// pixels (or 4x4 packets) of a tile are traced.
+//
+// Rays traced one after the other on the same core reuse each other's BVH
+// nodes and shapes from the cache if they go through nearby pixels. Row by
+// row order jumps back to the left edge at the end of every row; the Morton
+// and Hilbert orders stay in a small neighbourhood much longer.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+enum class TraversalOrder {
+	Tiled,   // row by row
+	Morton,  // Z-order curve
+	Hilbert, // Hilbert curve
+};
+
+// The cells (x, y) of a width x height grid, in the given order
+std::vector<glm::ivec2> traversalOrder(int width, int height, TraversalOrder order);
+
+char const *traversalOrderName(TraversalOrder order);
+// Reads "tiled", "morton" or "hilbert". Returns false for anything else.
+bool parseTraversalOrder(std::string const &name, TraversalOrder &order);
@@ -0,0 +1,324 @@
+#include "TriangleKernel.h"
+
+#include "RayTrace.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RT_X86_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+// MSVC lets us use AVX2 intrinsics without changing the compiler flags
+#define RT_TARGET_AVX2
+#else
+#define RT_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+
+// Tolerance of the Moller-Trumbore test
+const float EPSILON = 0.0000001f;
+
+int intersectScalar(TriangleSoA const &soa, Ray const &ray, int first, int count, float tMin, float &tMax, float &uHit, float &vHit) {
+	int nearest = -1;
+	for (int i = first; i < first + count; i++) {
+		glm::vec3 edge1 = soa.edge1(i);
+		glm::vec3 edge2 = soa.edge2(i);
+		glm::vec3 h = glm::cross(ray.direction, edge2);
+		float a = glm::dot(edge1, h);
+		if (a > -EPSILON && a < EPSILON) {
+			continue;
+		}
+		float f = 1.0f / a;
+		glm::vec3 s = ray.origin - glm::vec3(soa.v0x[i], soa.v0y[i], soa.v0z[i]);
+		float u = f * glm::dot(s, h);
+		if (u < 0.0f || u > 1.0f) {
+			continue;
+		}
+		glm::vec3 q = glm::cross(s, edge1);
+		float v = f * glm::dot(ray.direction, q);
+		if (v < 0.0f || u + v > 1.0f) {
+			continue;
+		}
+		float t = f * glm::dot(edge2, q);
+		if (t > tMin && t < tMax) {
+			tMax = t;
+			uHit = u;
+			vHit = v;
+			nearest = i;
+		}
+	}
+	return nearest;
+}
+
+#ifdef RT_X86_SIMD
+
+// Picks the lane with the smallest t out of the per-lane winners
+template <int WIDTH>
+int reduceLanes(float const *t, float const *u, float const *v, int const *index, float &tMax, float &uHit, float &vHit) {
+	int nearest = -1;
+	for (int lane = 0; lane < WIDTH; lane++) {
+		if (index[lane] >= 0 && t[lane] < tMax) {
+			tMax = t[lane];
+			uHit = u[lane];
+			vHit = v[lane];
+			nearest = index[lane];
+		}
+	}
+	return nearest;
+}
+
+int intersectSSE(TriangleSoA const &soa, Ray const &ray, int first, int count, float tMin, float &tMax, float &uHit, float &vHit) {
+	const __m128 eps = _mm_set1_ps(EPSILON);
+	const __m128 minT = _mm_set1_ps(tMin);
+	const __m128 negEps = _mm_set1_ps(-EPSILON);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 dx = _mm_set1_ps(ray.direction.x), dy = _mm_set1_ps(ray.direction.y), dz = _mm_set1_ps(ray.direction.z);
+	const __m128 ox = _mm_set1_ps(ray.origin.x), oy = _mm_set1_ps(ray.origin.y), oz = _mm_set1_ps(ray.origin.z);
+	const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128i end = _mm_set1_epi32(first + count);
+
+	__m128 bestT = _mm_set1_ps(tMax);
+	__m128 bestU = zero, bestV = zero;
+	__m128i bestIndex = _mm_set1_epi32(-1);
+
+	for (int i = first; i < first + count; i += 4) {
+		__m128i index = _mm_add_epi32(_mm_set1_epi32(i), lanes);
+		__m128 valid = _mm_castsi128_ps(_mm_cmplt_epi32(index, end));
+
+		__m128 e1x = _mm_loadu_ps(&soa.e1x[i]), e1y = _mm_loadu_ps(&soa.e1y[i]), e1z = _mm_loadu_ps(&soa.e1z[i]);
+		__m128 e2x = _mm_loadu_ps(&soa.e2x[i]), e2y = _mm_loadu_ps(&soa.e2y[i]), e2z = _mm_loadu_ps(&soa.e2z[i]);
+
+		// h = cross(d, e2), a = dot(e1, h)
+		__m128 hx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+		__m128 hy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+		__m128 hz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+		__m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, hx), _mm_mul_ps(e1y, hy)), _mm_mul_ps(e1z, hz));
+		valid = _mm_and_ps(valid, _mm_or_ps(_mm_cmple_ps(a, negEps), _mm_cmpge_ps(a, eps)));
+		__m128 f = _mm_div_ps(one, a);
+
+		// s = o - v0, u = f * dot(s, h)
+		__m128 sx = _mm_sub_ps(ox, _mm_loadu_ps(&soa.v0x[i]));
+		__m128 sy = _mm_sub_ps(oy, _mm_loadu_ps(&soa.v0y[i]));
+		__m128 sz = _mm_sub_ps(oz, _mm_loadu_ps(&soa.v0z[i]));
+		__m128 u = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, hx), _mm_mul_ps(sy, hy)), _mm_mul_ps(sz, hz)));
+		valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+
+		// q = cross(s, e1), v = f * dot(d, q), t = f * dot(e2, q)
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+		__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+		__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+		__m128 v = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)));
+		valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+		__m128 t = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)));
+		valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(t, minT), _mm_cmplt_ps(t, bestT)));
+
+		// SSE2 has no blend, so select with and / andnot / or
+		bestT = _mm_or_ps(_mm_and_ps(valid, t), _mm_andnot_ps(valid, bestT));
+		bestU = _mm_or_ps(_mm_and_ps(valid, u), _mm_andnot_ps(valid, bestU));
+		bestV = _mm_or_ps(_mm_and_ps(valid, v), _mm_andnot_ps(valid, bestV));
+		__m128i validBits = _mm_castps_si128(valid);
+		bestIndex = _mm_or_si128(_mm_and_si128(validBits, index), _mm_andnot_si128(validBits, bestIndex));
+	}
+
+	alignas(16) float t[4], u[4], v[4];
+	alignas(16) int index[4];
+	_mm_store_ps(t, bestT);
+	_mm_store_ps(u, bestU);
+	_mm_store_ps(v, bestV);
+	_mm_store_si128(reinterpret_cast<__m128i *>(index), bestIndex);
+	return reduceLanes<4>(t, u, v, index, tMax, uHit, vHit);
+}
+
+RT_TARGET_AVX2
+int intersectAVX2(TriangleSoA const &soa, Ray const &ray, int first, int count, float tMin, float &tMax, float &uHit, float &vHit) {
+	const __m256 eps = _mm256_set1_ps(EPSILON);
+	const __m256 minT = _mm256_set1_ps(tMin);
+	const __m256 negEps = _mm256_set1_ps(-EPSILON);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 dx = _mm256_set1_ps(ray.direction.x), dy = _mm256_set1_ps(ray.direction.y), dz = _mm256_set1_ps(ray.direction.z);
+	const __m256 ox = _mm256_set1_ps(ray.origin.x), oy = _mm256_set1_ps(ray.origin.y), oz = _mm256_set1_ps(ray.origin.z);
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i end = _mm256_set1_epi32(first + count);
+
+	__m256 bestT = _mm256_set1_ps(tMax);
+	__m256 bestU = zero, bestV = zero;
+	__m256i bestIndex = _mm256_set1_epi32(-1);
+
+	for (int i = first; i < first + count; i += 8) {
+		__m256i index = _mm256_add_epi32(_mm256_set1_epi32(i), lanes);
+		__m256 valid = _mm256_castsi256_ps(_mm256_cmpgt_epi32(end, index));
+
+		__m256 e1x = _mm256_loadu_ps(&soa.e1x[i]), e1y = _mm256_loadu_ps(&soa.e1y[i]), e1z = _mm256_loadu_ps(&soa.e1z[i]);
+		__m256 e2x = _mm256_loadu_ps(&soa.e2x[i]), e2y = _mm256_loadu_ps(&soa.e2y[i]), e2z = _mm256_loadu_ps(&soa.e2z[i]);
+
+		// h = cross(d, e2), a = dot(e1, h)
+		__m256 hx = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+		__m256 hy = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+		__m256 hz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+		__m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, hx), _mm256_mul_ps(e1y, hy)), _mm256_mul_ps(e1z, hz));
+		valid = _mm256_and_ps(valid, _mm256_or_ps(_mm256_cmp_ps(a, negEps, _CMP_LE_OQ), _mm256_cmp_ps(a, eps, _CMP_GE_OQ)));
+		__m256 f = _mm256_div_ps(one, a);
+
+		// s = o - v0, u = f * dot(s, h)
+		__m256 sx = _mm256_sub_ps(ox, _mm256_loadu_ps(&soa.v0x[i]));
+		__m256 sy = _mm256_sub_ps(oy, _mm256_loadu_ps(&soa.v0y[i]));
+		__m256 sz = _mm256_sub_ps(oz, _mm256_loadu_ps(&soa.v0z[i]));
+		__m256 u = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, hx), _mm256_mul_ps(sy, hy)), _mm256_mul_ps(sz, hz)));
+		valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+
+		// q = cross(s, e1), v = f * dot(d, q), t = f * dot(e2, q)
+		__m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+		__m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+		__m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+		__m256 v = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)));
+		valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+		__m256 t = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)));
+		valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, minT, _CMP_GT_OQ), _mm256_cmp_ps(t, bestT, _CMP_LT_OQ)));
+
+		bestT = _mm256_blendv_ps(bestT, t, valid);
+		bestU = _mm256_blendv_ps(bestU, u, valid);
+		bestV = _mm256_blendv_ps(bestV, v, valid);
+		bestIndex = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(bestIndex), _mm256_castsi256_ps(index), valid));
+	}
+
+	alignas(32) float t[8], u[8], v[8];
+	alignas(32) int index[8];
+	_mm256_store_ps(t, bestT);
+	_mm256_store_ps(u, bestU);
+	_mm256_store_ps(v, bestV);
+	_mm256_store_si256(reinterpret_cast<__m256i *>(index), bestIndex);
+	return reduceLanes<8>(t, u, v, index, tMax, uHit, vHit);
+}
+
+bool cpuHasAVX2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	// The OS also has to save the AVX registers on context switches
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // RT_X86_SIMD
+
+bool kernelSupported(TriangleKernel kernel) {
+	switch (kernel) {
+	case TriangleKernel::Scalar:
+		return true;
+#ifdef RT_X86_SIMD
+	case TriangleKernel::SSE:
+		return true; // part of x86-64
+	case TriangleKernel::AVX2:
+		return cpuHasAVX2();
+#endif
+	default:
+		return false;
+	}
+}
+
+TriangleKernel &currentKernel() {
+	static TriangleKernel kernel = kernelSupported(TriangleKernel::AVX2) ? TriangleKernel::AVX2
+		: kernelSupported(TriangleKernel::SSE) ? TriangleKernel::SSE
+		: TriangleKernel::Scalar;
+	return kernel;
+}
+
+} // namespace
+
+void TriangleSoA::build(glm::vec3 const *corners, std::vector<int> const &order) {
+	count = static_cast<int>(order.size());
+	pages = nullptr;
+	std::vector<float> values[ARRAYS];
+	for (auto &a : values) {
+		a.assign(count + PADDING, 0.0f);
+	}
+
+	for (int i = 0; i < count; i++) {
+		glm::vec3 const *tri = corners + 3 * size_t(order[i]);
+		glm::vec3 e1 = tri[1] - tri[0];
+		glm::vec3 e2 = tri[2] - tri[0];
+		values[0][i] = tri[0].x; values[1][i] = tri[0].y; values[2][i] = tri[0].z;
+		values[3][i] = e1.x; values[4][i] = e1.y; values[5][i] = e1.z;
+		values[6][i] = e2.x; values[7][i] = e2.y; values[8][i] = e2.z;
+	}
+
+	MappedArray<float> *arrays[] = { &v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z };
+	for (int k = 0; k < ARRAYS; k++) {
+		arrays[k]->assign(std::move(values[k]));
+	}
+}
+
+void TriangleSoA::view(PageBudget *budget, size_t offset, size_t stride, int n) {
+	count = n;
+	MappedArray<float> *arrays[] = { &v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z };
+	for (int k = 0; k < ARRAYS; k++) {
+		arrays[k]->view(reinterpret_cast<float const *>(budget->file().data() + offset + k * stride), size_t(n + PADDING));
+	}
+	pages = budget;
+	pagesOffset = offset;
+	pagesStride = stride;
+}
+
+int intersectTriangleSoA(TriangleSoA const &soa, Ray const &ray, int first, int count, float tMin, float &tMax) {
+	float u, v;
+	switch (currentKernel()) {
+#ifdef RT_X86_SIMD
+	case TriangleKernel::AVX2:
+		return intersectAVX2(soa, ray, first, count, tMin, tMax, u, v);
+	case TriangleKernel::SSE:
+		return intersectSSE(soa, ray, first, count, tMin, tMax, u, v);
+#endif
+	default:
+		return intersectScalar(soa, ray, first, count, tMin, tMax, u, v);
+	}
+}
+
+int intersectTriangleSoA(TriangleSoA const &soa, Ray const &ray, int first, int count, float &tMax, float &u, float &v) {
+	switch (currentKernel()) {
+#ifdef RT_X86_SIMD
+	case TriangleKernel::AVX2:
+		return intersectAVX2(soa, ray, first, count, EPSILON, tMax, u, v);
+	case TriangleKernel::SSE:
+		return intersectSSE(soa, ray, first, count, EPSILON, tMax, u, v);
+#endif
+	default:
+		return intersectScalar(soa, ray, first, count, EPSILON, tMax, u, v);
+	}
+}
+
+TriangleKernel activeTriangleKernel() {
+	return currentKernel();
+}
+
+bool selectTriangleKernel(TriangleKernel kernel) {
+	// Not thread safe: only switch kernels while nothing is being rendered.
+	if (!kernelSupported(kernel)) {
+		return false;
+	}
+	currentKernel() = kernel;
+	return true;
+}
+
+char const *triangleKernelName(TriangleKernel kernel) {
+	switch (kernel) {
+	case TriangleKernel::SSE: return "SSE (4 wide)";
+	case TriangleKernel::AVX2: return "AVX2 (8 wide)";
+	default: return "scalar";
+	}
+}
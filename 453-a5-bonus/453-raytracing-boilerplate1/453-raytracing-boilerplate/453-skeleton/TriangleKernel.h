@@ -0,0 +1,76 @@
+//------------------------------------------------------------------------------
+// Structure-of-arrays triangle storage and a Moller-Trumbore kernel that tests
+// several triangles against one ray at once.
+//
+// On x86-64 the kernel uses AVX2 (8 triangles at a time) when the CPU has it
+// and SSE (4 at a time) otherwise. Everywhere else it falls back to plain
+// scalar code. The choice is made once, at runtime.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "MappedArray.h"
+#include "PageBudget.h"
+#include "Ray.h"
+
+// Triangles as first vertex + two edges, one array per component. The arrays
+// are padded with degenerate triangles so that kernels can always read 8
+// triangles starting from any valid index. They can also be read straight
+// from a mapped mesh file (see MeshFile.h).
+struct TriangleSoA {
+	static const int PADDING = 8;
+	static const int ARRAYS = 9;
+
+	MappedArray<float> v0x, v0y, v0z;
+	MappedArray<float> e1x, e1y, e1z;
+	MappedArray<float> e2x, e2y, e2z;
+	int count = 0;
+
+	// Stores triangle order[0], order[1], ... in that order, where triangle i
+	// has the corners corners[3 * i], corners[3 * i + 1] and corners[3 * i + 2]
+	void build(glm::vec3 const *corners, std::vector<int> const &order);
+
+	// Uses `n` triangles from budget's file, where array k (in the order
+	// above, each count + PADDING floats long) starts at offset + k * stride
+	void view(PageBudget *budget, size_t offset, size_t stride, int n);
+
+	// Reports that the kernel is about to read triangles [first, first + n),
+	// if they are in a mapped file
+	void touch(int first, int n) const {
+		if (pages) {
+			for (int k = 0; k < ARRAYS; k++) {
+				pages->touch(pagesOffset + k * pagesStride + size_t(first) * sizeof(float), size_t(n + PADDING) * sizeof(float));
+			}
+		}
+	}
+
+	glm::vec3 edge1(int i) const { return glm::vec3(e1x[i], e1y[i], e1z[i]); }
+	glm::vec3 edge2(int i) const { return glm::vec3(e2x[i], e2y[i], e2z[i]); }
+
+private:
+	PageBudget *pages = nullptr;
+	size_t pagesOffset = 0;
+	size_t pagesStride = 0;
+};
+
+enum class TriangleKernel {
+	Scalar,
+	SSE,  // 4 wide
+	AVX2, // 8 wide
+};
+
+// Tests triangles [first, first + count) against the ray. Returns the index of
+// the nearest one hit with tMin < t < tMax (and lowers tMax to its t), or -1.
+int intersectTriangleSoA(TriangleSoA const &soa, Ray const &ray, int first, int count, float tMin, float &tMax);
+// Same, for hits past the kernel's own tiny tolerance, and also sets the
+// barycentric coordinates (u, v) of the hit on that triangle:
+// hit = v0 + u * edge1 + v * edge2.
+int intersectTriangleSoA(TriangleSoA const &soa, Ray const &ray, int first, int count, float &tMax, float &u, float &v);
+
+// The kernel intersectTriangleSoA uses, and a way to force a different one
+// (for benchmarking). Returns false if the CPU doesn't support that kernel.
+TriangleKernel activeTriangleKernel();
+bool selectTriangleKernel(TriangleKernel kernel);
+char const *triangleKernelName(TriangleKernel kernel);
@@ -0,0 +1,122 @@
+#include "UniformGrid.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+#include "Parallel.h"
+
+namespace {
+
+// Grids over more primitives than this are filled in on several threads
+const int PARALLEL_THRESHOLD = 16 * 1024;
+
+glm::vec3 padding(AABB const &b) {
+	return 1e-5f * glm::max(glm::vec3(1.0f), glm::max(glm::abs(b.min), glm::abs(b.max)));
+}
+
+} // namespace
+
+void UniformGrid::cellRange(AABB const &primBounds, glm::ivec3 &lo, glm::ivec3 &hi) const {
+	glm::vec3 pad = padding(primBounds);
+	glm::vec3 last = glm::vec3(res - 1);
+	lo = glm::ivec3(glm::clamp(glm::floor((primBounds.min - pad - box.min) / cellSize), glm::vec3(0.0f), last));
+	hi = glm::ivec3(glm::clamp(glm::floor((primBounds.max + pad - box.min) / cellSize), glm::vec3(0.0f), last));
+}
+
+void UniformGrid::build(std::vector<AABB> const &primBounds) {
+	box = AABB();
+	res = glm::ivec3(0);
+	cellStart.clear();
+	cellPrims.clear();
+	int count = static_cast<int>(primBounds.size());
+	if (count == 0) {
+		return;
+	}
+	int chunks = std::min(std::max(1u, std::thread::hardware_concurrency()), unsigned(count / PARALLEL_THRESHOLD + 1));
+
+	for (AABB const &b : primBounds) {
+		box.extend(b);
+	}
+	glm::vec3 pad = padding(box);
+	box.min -= pad;
+	box.max += pad;
+
+	// Cubic cells, as many as GRID_DENSITY asks for. A flat box is given some
+	// thickness so the volume isn't 0.
+	glm::vec3 extent = glm::max(box.extent(), glm::vec3(1e-3f * glm::max(glm::max(box.extent().x, box.extent().y), box.extent().z)));
+	box.max = box.min + extent;
+	float cellsPerUnit = std::cbrt(GRID_DENSITY * count / (extent.x * extent.y * extent.z));
+	for (int axis = 0; axis < 3; axis++) {
+		res[axis] = std::min(std::max(static_cast<int>(extent[axis] * cellsPerUnit), 1), GRID_MAX_RESOLUTION);
+	}
+	cellSize = extent / glm::vec3(res);
+	int cells = res.x * res.y * res.z;
+
+	// Counting sort of the primitives into the cells: count how many go into
+	// each cell, add those up into where each cell starts, then put every
+	// primitive into its cells
+	auto forEachCell = [&](int prim, auto &&fn) {
+		glm::ivec3 lo, hi;
+		cellRange(primBounds[prim], lo, hi);
+		for (int z = lo.z; z <= hi.z; z++) {
+			for (int y = lo.y; y <= hi.y; y++) {
+				for (int x = lo.x; x <= hi.x; x++) {
+					fn(cellIndex(glm::ivec3(x, y, z)));
+				}
+			}
+		}
+	};
+	cellStart.assign(cells + 1, 0);
+	auto cellsToStarts = [&] {
+		int total = 0;
+		for (int c = 0; c <= cells; c++) {
+			int n = cellStart[c];
+			cellStart[c] = total;
+			total += n;
+		}
+		cellPrims.resize(total);
+	};
+
+	if (chunks == 1) {
+		for (int i = 0; i < count; i++) {
+			forEachCell(i, [&](int c) { cellStart[c]++; });
+		}
+		cellsToStarts();
+		std::vector<int> cursor(cellStart.begin(), cellStart.end() - 1);
+		for (int i = 0; i < count; i++) {
+			forEachCell(i, [&](int c) { cellPrims[cursor[c]++] = i; });
+		}
+		return;
+	}
+
+	// The same on several threads, which share the counters
+	std::vector<std::atomic<int>> cursor(cells);
+	parallelChunks(0, count, chunks, [&](int, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			forEachCell(i, [&](int c) { cursor[c].fetch_add(1, std::memory_order_relaxed); });
+		}
+	});
+	for (int c = 0; c < cells; c++) {
+		cellStart[c] = cursor[c].load(std::memory_order_relaxed);
+	}
+	cellsToStarts();
+	for (int c = 0; c < cells; c++) {
+		cursor[c].store(cellStart[c], std::memory_order_relaxed);
+	}
+	parallelChunks(0, count, chunks, [&](int, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			forEachCell(i, [&](int c) { cellPrims[cursor[c].fetch_add(1, std::memory_order_relaxed)] = i; });
+		}
+	});
+
+	// On one thread every cell lists its primitives in order. Sort them back
+	// into that order, so that which of two equally near hits wins doesn't
+	// depend on the threads.
+	parallelChunks(0, cells, chunks, [&](int, int begin, int end) {
+		for (int c = begin; c < end; c++) {
+			std::sort(cellPrims.begin() + cellStart[c], cellPrims.begin() + cellStart[c + 1]);
+		}
+	});
+}
@@ -0,0 +1,159 @@
+//------------------------------------------------------------------------------
+// A uniform grid over a set of primitives that are only known by their
+// bounding boxes, the other way (besides BVH) of telling the caller which
+// primitives a ray could hit.
+//
+// Every cell lists the primitives whose boxes overlap it. A ray walks the
+// cells it passes through in order (3D-DDA), so once it has a hit inside the
+// cell it is in, it is done. It traces slower than a BVH when the primitives
+// are of very different sizes or bunched up in one corner, but it is built
+// with a counting sort of the primitives into the cells, a couple of linear
+// passes on several threads. When everything moves every frame, that beats
+// building (or refitting) a BVH.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Ray.h"
+#include "RayPacket.h"
+
+// Number of cells the grid aims for per primitive
+const float GRID_DENSITY = 2.0f;
+
+// Most cells along any one axis
+const int GRID_MAX_RESOLUTION = 128;
+
+class UniformGrid {
+public:
+	// Builds the grid for primitives 0 .. primBounds.size()-1. Big grids are
+	// filled in on several threads.
+	void build(std::vector<AABB> const &primBounds);
+
+	bool empty() const { return cellStart.empty(); }
+	AABB const &bounds() const { return box; }
+	glm::ivec3 resolution() const { return res; }
+	size_t memoryBytes() const { return (cellStart.size() + cellPrims.size()) * sizeof(int); }
+
+	// Closest hit traversal. Calls intersectCell(prims, count, tMax) with the
+	// primitives of every cell the ray passes through before tMax, nearest
+	// first; intersectCell should lower tMax when it finds a closer hit. A
+	// primitive that overlaps several cells is handed over once for each.
+	template <typename F>
+	void traverse(Ray const &ray, float &tMax, F &&intersectCell) const;
+
+	// Any hit traversal. Stops as soon as occludedCell(prims, count) returns true.
+	template <typename F>
+	bool traverseAny(Ray const &ray, float tMax, F &&occludedCell) const;
+
+	// Closest hit traversal for a packet of rays. The lanes don't follow the
+	// same cells for long, so each one walks the grid on its own, and
+	// intersectCell(prims, count, lane) is called for one lane at a time.
+	template <typename F>
+	void traversePacket(RayPacket const &packet, uint32_t active, float *tMax, F &&intersectCell) const;
+
+private:
+	AABB box;
+	glm::ivec3 res{ 0 };
+	glm::vec3 cellSize{ 0.0f };
+	std::vector<int> cellStart; // cell c holds cellPrims[cellStart[c] .. cellStart[c + 1])
+	std::vector<int> cellPrims;
+
+	int cellIndex(glm::ivec3 cell) const { return (cell.z * res.y + cell.y) * res.x + cell.x; }
+
+	// The cells the box overlaps, a little grown so a primitive that only
+	// touches a cell wall is in the cells on both sides of it
+	void cellRange(AABB const &primBounds, glm::ivec3 &lo, glm::ivec3 &hi) const;
+
+	// Calls visitCell(prims, count, tExit) for the cells the ray passes
+	// through, in order, where tExit is where the ray leaves the cell. Stops
+	// when that returns true, when the ray leaves the grid, or past tMax
+	// (which visitCell may lower).
+	template <typename F>
+	void walk(Ray const &ray, float const &tMax, F &&visitCell) const;
+};
+
+// -----------------------------------------------------------------------------
+
+template <typename F>
+void UniformGrid::walk(Ray const &ray, float const &tMax, F &&visitCell) const {
+	if (cellStart.empty()) {
+		return;
+	}
+
+	glm::vec3 invDir = 1.0f / ray.direction;
+	float tEnter;
+	if (!box.intersect(ray.origin, invDir, tMax, tEnter)) {
+		return;
+	}
+
+	// The cell the ray starts in, and where it crosses the next cell wall
+	// along each axis
+	glm::vec3 entry = (ray.origin + tEnter * ray.direction - box.min) / cellSize;
+	glm::ivec3 cell = glm::ivec3(glm::clamp(glm::floor(entry), glm::vec3(0.0f), glm::vec3(res - 1)));
+	glm::ivec3 step, stop;
+	glm::vec3 tNext, tDelta;
+	for (int axis = 0; axis < 3; axis++) {
+		if (ray.direction[axis] > 0.0f) {
+			step[axis] = 1;
+			stop[axis] = res[axis];
+			tNext[axis] = (box.min[axis] + float(cell[axis] + 1) * cellSize[axis] - ray.origin[axis]) * invDir[axis];
+			tDelta[axis] = cellSize[axis] * invDir[axis];
+		} else if (ray.direction[axis] < 0.0f) {
+			step[axis] = -1;
+			stop[axis] = -1;
+			tNext[axis] = (box.min[axis] + float(cell[axis]) * cellSize[axis] - ray.origin[axis]) * invDir[axis];
+			tDelta[axis] = -cellSize[axis] * invDir[axis];
+		} else {
+			step[axis] = 0;
+			stop[axis] = -1;
+			tNext[axis] = std::numeric_limits<float>::max();
+			tDelta[axis] = 0.0f;
+		}
+	}
+
+	while (true) {
+		int axis = tNext.x < tNext.y ? (tNext.x < tNext.z ? 0 : 2) : (tNext.y < tNext.z ? 1 : 2);
+		float tExit = tNext[axis];
+		int c = cellIndex(cell);
+		if (visitCell(cellPrims.data() + cellStart[c], cellStart[c + 1] - cellStart[c], tExit) || tExit > tMax) {
+			return;
+		}
+		cell[axis] += step[axis];
+		if (cell[axis] == stop[axis]) {
+			return;
+		}
+		tNext[axis] += tDelta[axis];
+	}
+}
+
+template <typename F>
+void UniformGrid::traverse(Ray const &ray, float &tMax, F &&intersectCell) const {
+	walk(ray, tMax, [&](int const *prims, int count, float tExit) {
+		intersectCell(prims, count, tMax);
+		// A hit inside this cell is nearer than anything in the cells after it
+		return tMax <= tExit;
+	});
+}
+
+template <typename F>
+bool UniformGrid::traverseAny(Ray const &ray, float tMax, F &&occludedCell) const {
+	bool occluded = false;
+	walk(ray, tMax, [&](int const *prims, int count, float) {
+		occluded = occludedCell(prims, count);
+		return occluded;
+	});
+	return occluded;
+}
+
+template <typename F>
+void UniformGrid::traversePacket(RayPacket const &packet, uint32_t active, float *tMax, F &&intersectCell) const {
+	forEachLane(active, [&](int lane) {
+		walk(packet.ray(lane), tMax[lane], [&](int const *prims, int count, float tExit) {
+			intersectCell(prims, count, lane);
+			return tMax[lane] <= tExit;
+		});
+	});
+}
@@ -0,0 +1,327 @@
+#include "Wavefront.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "Lighting.h"
+#include "Log.h"
+#include "Morton.h"
+#include "RayPacket.h"
+#include "ShapeBuckets.h"
+
+namespace {
+
+// Rays waiting to be extended, one array per field
+struct RayQueue {
+	std::vector<float> ox, oy, oz;
+	std::vector<float> dx, dy, dz;
+	std::vector<glm::vec3> weight; // how much of what the ray sees ends up in its pixel
+	std::vector<int> pixel;        // index into the band's pixels
+	std::vector<int> sourceID;     // shape the ray leaves from, -1 for camera rays
+	std::vector<int> level;        // bounces it may still take
+
+	int size() const { return static_cast<int>(pixel.size()); }
+
+	void resize(int n) {
+		ox.resize(n); oy.resize(n); oz.resize(n);
+		dx.resize(n); dy.resize(n); dz.resize(n);
+		weight.resize(n);
+		pixel.resize(n);
+		sourceID.resize(n);
+		level.resize(n);
+	}
+
+	void set(int i, Ray const &ray, glm::vec3 w, int p, int source, int l) {
+		ox[i] = ray.origin.x; oy[i] = ray.origin.y; oz[i] = ray.origin.z;
+		dx[i] = ray.direction.x; dy[i] = ray.direction.y; dz[i] = ray.direction.z;
+		weight[i] = w;
+		pixel[i] = p;
+		sourceID[i] = source;
+		level[i] = l;
+	}
+
+	Ray ray(int i) const {
+		return Ray(glm::vec3(ox[i], oy[i], oz[i]), glm::vec3(dx[i], dy[i], dz[i]));
+	}
+
+	void copy(int to, RayQueue const &from, int i) {
+		set(to, from.ray(i), from.weight[i], from.pixel[i], from.sourceID[i], from.level[i]);
+	}
+};
+
+// Shadow rays waiting to be connected to the light, and the colour each adds
+// to its pixel if it gets there (or not). Colours are already weighted.
+struct ShadowQueue {
+	std::vector<float> ox, oy, oz;
+	std::vector<float> dx, dy, dz;
+	std::vector<float> tMax;
+	std::vector<int> sourceID;
+	std::vector<int> pixel;
+	std::vector<glm::vec3> litColor, shadowedColor;
+	std::vector<char> blocked; // filled in by connect
+
+	void resize(int n) {
+		ox.resize(n); oy.resize(n); oz.resize(n);
+		dx.resize(n); dy.resize(n); dz.resize(n);
+		tMax.resize(n);
+		sourceID.resize(n);
+		pixel.resize(n);
+		litColor.resize(n);
+		shadowedColor.resize(n);
+		blocked.resize(n);
+	}
+
+	void set(int i, Ray const &ray, float t, int source, int p, glm::vec3 lit, glm::vec3 shadowed) {
+		ox[i] = ray.origin.x; oy[i] = ray.origin.y; oz[i] = ray.origin.z;
+		dx[i] = ray.direction.x; dy[i] = ray.direction.y; dz[i] = ray.direction.z;
+		tMax[i] = t;
+		sourceID[i] = source;
+		pixel[i] = p;
+		litColor[i] = lit;
+		shadowedColor[i] = shadowed;
+	}
+
+	Ray ray(int i) const {
+		return Ray(glm::vec3(ox[i], oy[i], oz[i]), glm::vec3(dx[i], dy[i], dz[i]));
+	}
+};
+
+// Everything the stages pass between each other, kept from band to band so
+// the arrays are only allocated once
+struct Wavefront {
+	RayQueue rays;      // to extend this round
+	RayQueue staged;    // rays the shade stage made, two slots per ray it shaded
+	std::vector<Hit> hits;
+	std::vector<glm::vec3> emitted; // colour each ray adds to its pixel by itself
+	ShadowQueue shadows;            // one slot per ray shaded
+	std::vector<int> stagedCount;   // per chunk of the shade stage
+	std::vector<int> shadowCount;
+	std::vector<int> stagedOffset;
+	std::vector<glm::vec3> pixels;  // the band being traced
+
+	// For sorting the secondary rays
+	RayQueue sorted;
+	std::vector<uint64_t> keys;
+	std::vector<AABB> chunkBounds;
+};
+
+// Sort key of a ray: the octant its direction points into, then the Morton
+// code of its origin in the box around all the origins. Rays next to each
+// other in this order start close together and go the same general way, so
+// they tend to visit the same BVH nodes one after the other.
+uint64_t rayKey(Ray const &ray, AABB const &origins, glm::vec3 cellsPerUnit) {
+	uint32_t octant = (ray.direction.x < 0.0f ? 4 : 0) | (ray.direction.y < 0.0f ? 2 : 0) | (ray.direction.z < 0.0f ? 1 : 0);
+	glm::uvec3 cell = glm::uvec3(glm::clamp((ray.origin - origins.min) * cellsPerUnit, glm::vec3(0.0f), glm::vec3(1023.0f)));
+	return (uint64_t(octant) << 30) | mortonCode3(cell.x, cell.y, cell.z);
+}
+
+// Reorders the rays by rayKey. Their pixel index goes with them, so colours
+// still end up in the right place.
+void sortRays(Wavefront &wave, TileScheduler &scheduler) {
+	int count = wave.rays.size();
+	int chunks = (count + WAVEFRONT_CHUNK_SIZE - 1) / WAVEFRONT_CHUNK_SIZE;
+
+	wave.chunkBounds.assign(chunks, AABB());
+	scheduler.parallelFor(count, WAVEFRONT_CHUNK_SIZE, [&](int begin, int end, int) {
+		AABB &bounds = wave.chunkBounds[begin / WAVEFRONT_CHUNK_SIZE];
+		for (int i = begin; i < end; i++) {
+			bounds.extend(glm::vec3(wave.rays.ox[i], wave.rays.oy[i], wave.rays.oz[i]));
+		}
+	});
+	AABB origins;
+	for (AABB const &bounds : wave.chunkBounds) {
+		origins.extend(bounds.min);
+		origins.extend(bounds.max);
+	}
+	glm::vec3 cellsPerUnit = 1024.0f / glm::max(origins.max - origins.min, glm::vec3(1e-6f));
+
+	// The ray's index goes in the low 31 bits, so sorting the keys gives the
+	// new order without a separate index array (and is stable)
+	wave.keys.resize(count);
+	scheduler.parallelFor(count, WAVEFRONT_CHUNK_SIZE, [&](int begin, int end, int) {
+		for (int i = begin; i < end; i++) {
+			wave.keys[i] = (rayKey(wave.rays.ray(i), origins, cellsPerUnit) << 31) | uint64_t(i);
+		}
+	});
+	std::sort(wave.keys.begin(), wave.keys.end());
+
+	wave.sorted.resize(count);
+	scheduler.parallelFor(count, WAVEFRONT_CHUNK_SIZE, [&](int begin, int end, int) {
+		for (int i = begin; i < end; i++) {
+			wave.sorted.copy(i, wave.rays, int(wave.keys[i] & 0x7fffffff));
+		}
+	});
+	std::swap(wave.rays, wave.sorted);
+}
+
+} // namespace
+
+bool raytraceImageWavefront(Scene const &scene, Framebuffer &image, CameraRays const &camera, TileScheduler &scheduler, RenderSettings const &settings, std::atomic<bool> const *cancel) {
+	auto cancelled = [cancel] {
+		return cancel && cancel->load(std::memory_order_relaxed);
+	};
+
+	int width = image.Width();
+	int height = image.Height();
+	int samples = std::max(settings.samplesPerPixel, 1);
+	glm::vec3 sampleWeight(1.0f / samples);
+
+	// Bands are a whole number of 4 pixel high rows of packets
+	int bandRows = std::max(RayPacket::WIDTH, WAVEFRONT_BATCH_SIZE / (width * samples) / RayPacket::WIDTH * RayPacket::WIDTH);
+
+	// How long extend takes on the reflection / refraction rays, which are
+	// the ones that sortSecondaryRays is meant to speed up
+	int64_t secondaryRays = 0;
+	std::chrono::duration<double> secondaryExtendTime(0);
+
+	Wavefront wave;
+	for (int y0 = 0; y0 < height; y0 += bandRows) {
+		int y1 = std::min(y0 + bandRows, height);
+		int bandPixels = width * (y1 - y0);
+		wave.pixels.assign(bandPixels, glm::vec3(0.0f));
+
+		// Generate: camera rays in the order of the 4x4 blocks they're in (and
+		// sample by sample), so that every 16 rays in a row make a packet
+		int blockRows = (y1 - y0 + RayPacket::WIDTH - 1) / RayPacket::WIDTH;
+		wave.rays.resize(bandPixels * samples);
+		scheduler.parallelFor(blockRows * samples, 1, [&](int begin, int, int) {
+			int sample = begin / blockRows;
+			int rowStart = y0 + (begin % blockRows) * RayPacket::WIDTH;
+			int rows = std::min(RayPacket::WIDTH, y1 - rowStart);
+			int i = sample * bandPixels + (rowStart - y0) * width;
+			glm::vec2 offset = pixelSampleOffset(sample);
+			for (int bx = 0; bx < width; bx += RayPacket::WIDTH) {
+				int x1 = std::min(bx + RayPacket::WIDTH, width);
+				for (int y = rowStart; y < rowStart + rows; y++) {
+					for (int x = bx; x < x1; x++) {
+						Ray ray = samples == 1 ? camera.ray(x, y) : camera.rayThrough(x + offset.x, y + offset.y);
+						wave.rays.set(i++, ray, sampleWeight, (y - y0) * width + x, -1, RENDER_MAX_DEPTH);
+					}
+				}
+			}
+		});
+
+		for (int round = 0; wave.rays.size() > 0; round++) {
+			if (cancelled()) {
+				return false;
+			}
+			int count = wave.rays.size();
+			int chunks = (count + WAVEFRONT_CHUNK_SIZE - 1) / WAVEFRONT_CHUNK_SIZE;
+			auto extendStart = std::chrono::steady_clock::now();
+
+			// Extend: camera rays go in packets, the others (which have a shape
+			// to skip, and point every which way) one at a time
+			wave.hits.resize(count);
+			scheduler.parallelFor(count, WAVEFRONT_CHUNK_SIZE, [&](int begin, int end, int) {
+				for (int first = begin; first < end; first += RayPacket::SIZE) {
+					int lanes = std::min(RayPacket::SIZE, end - first);
+					bool cameraRays = std::all_of(&wave.rays.sourceID[first], &wave.rays.sourceID[first] + lanes, [](int id) { return id < 0; });
+					if (settings.packets && cameraRays) {
+						RayPacket packet;
+						for (int lane = 0; lane < RayPacket::SIZE; lane++) {
+							packet.set(lane, wave.rays.ray(first + std::min(lane, lanes - 1)));
+						}
+						Hit closest[RayPacket::SIZE];
+						scene.accel->intersectPacket(packet, (1u << lanes) - 1, closest);
+						std::copy_n(closest, lanes, &wave.hits[first]);
+					} else {
+						for (int i = first; i < first + lanes; i++) {
+							wave.hits[i] = getClosestHit(scene, wave.rays.ray(i), wave.rays.sourceID[i]);
+						}
+					}
+				}
+			});
+			if (round > 0) {
+				secondaryRays += count;
+				secondaryExtendTime += std::chrono::steady_clock::now() - extendStart;
+			}
+
+			// Shade: every chunk writes its shadow rays and new rays to its own
+			// part of the staging queues, and counts them
+			wave.emitted.resize(count);
+			wave.shadows.resize(count);
+			wave.staged.resize(count * 2);
+			wave.stagedCount.assign(chunks, 0);
+			wave.shadowCount.assign(chunks, 0);
+			scheduler.parallelFor(count, WAVEFRONT_CHUNK_SIZE, [&](int begin, int end, int) {
+				int chunk = begin / WAVEFRONT_CHUNK_SIZE;
+				int shadowsMade = 0;
+				int raysMade = 0;
+				for (int i = begin; i < end; i++) {
+					Ray ray = wave.rays.ray(i);
+					Intersection result = resolveHit(scene, ray, wave.hits[i]);
+					glm::vec3 weight = wave.rays.weight[i];
+					int pixel = wave.rays.pixel[i];
+					wave.emitted[i] = glm::vec3(0.0f);
+
+					//return local color on recursion limit
+					if (wave.rays.level[i] < 1) {
+						PhongReflection phong(result, scene.materials[result.material], ray, scene);
+						wave.emitted[i] = weight * phong.I();
+						continue;
+					}
+					if (!result.found) {
+						continue;
+					}
+
+					SurfaceScatter scatter;
+					scatterAt(scene, ray, result, scatter);
+					wave.shadows.set(begin + shadowsMade++, scatter.shadowRay, scatter.lightDistance, result.id, pixel,
+						weight * scatter.localShare * scatter.litColor, weight * scatter.localShare * scatter.shadowedColor);
+					for (int k = 0; k < scatter.rayCount; k++) {
+						glm::vec3 rayWeight = weight * scatter.shares[k];
+						if (keepRay(scatter.rays[k], rayWeight, settings)) {
+							wave.staged.set(2 * begin + raysMade++, scatter.rays[k], rayWeight, pixel, result.id, wave.rays.level[i] - 1);
+						}
+					}
+				}
+				wave.shadowCount[chunk] = shadowsMade;
+				wave.stagedCount[chunk] = raysMade;
+			});
+
+			// Connect: trace the shadow rays where the shade stage left them
+			scheduler.parallelFor(count, WAVEFRONT_CHUNK_SIZE, [&](int begin, int, int) {
+				int chunk = begin / WAVEFRONT_CHUNK_SIZE;
+				for (int i = begin; i < begin + wave.shadowCount[chunk]; i++) {
+					wave.shadows.blocked[i] = occluded(scene, wave.shadows.ray(i), wave.shadows.tMax[i], wave.shadows.sourceID[i]);
+				}
+			});
+
+			// Add up the colours in ray order, so the image doesn't depend on
+			// how the chunks were spread over the threads
+			for (int i = 0; i < count; i++) {
+				wave.pixels[wave.rays.pixel[i]] += wave.emitted[i];
+			}
+			for (int chunk = 0; chunk < chunks; chunk++) {
+				int begin = chunk * WAVEFRONT_CHUNK_SIZE;
+				for (int i = begin; i < begin + wave.shadowCount[chunk]; i++) {
+					wave.pixels[wave.shadows.pixel[i]] += wave.shadows.blocked[i] ? wave.shadows.shadowedColor[i] : wave.shadows.litColor[i];
+				}
+			}
+
+			// The rays made by shade, packed together for the next round
+			wave.stagedOffset.resize(chunks);
+			int next = 0;
+			for (int chunk = 0; chunk < chunks; chunk++) {
+				wave.stagedOffset[chunk] = next;
+				next += wave.stagedCount[chunk];
+			}
+			wave.rays.resize(next);
+			scheduler.parallelFor(count, WAVEFRONT_CHUNK_SIZE, [&](int begin, int, int) {
+				int chunk = begin / WAVEFRONT_CHUNK_SIZE;
+				for (int k = 0; k < wave.stagedCount[chunk]; k++) {
+					wave.rays.copy(wave.stagedOffset[chunk] + k, wave.staged, 2 * begin + k);
+				}
+			});
+			if (settings.sortSecondaryRays && next > 1) {
+				sortRays(wave, scheduler);
+			}
+		}
+
+		image.SetPixels(0, y0, width, y1 - y0, wave.pixels.data());
+	}
+
+	Log::info("Wavefront: extended {} secondary rays in {:.1f} ms{}", secondaryRays, secondaryExtendTime.count() * 1000.0, settings.sortSecondaryRays ? " (sorted)" : "");
+	return !cancelled();
+}
@@ -0,0 +1,36 @@
+//------------------------------------------------------------------------------
+// Wavefront rendering: instead of following each pixel's rays all the way
+// before starting on the next pixel, a big batch of rays goes through one
+// stage at a time:
+//
+//   generate  camera rays for a band of rows of the image
+//   extend    find the closest hit of every ray in the queue
+//   shade     light every hit, and queue a shadow ray for it and its
+//             reflection / refraction rays for the next round of extend
+//   connect   trace the shadow rays, and add the colours found to the pixels
+//
+// The stages hand the rays to each other in structure-of-arrays queues, and
+// each stage is a parallel loop over its queue. A stage runs the same small
+// piece of code over thousands of rays in a row, camera rays are intersected
+// in packets, and the rays' branches (hit or miss, lit or in shadow, reflect
+// or refract) only decide what goes in which queue.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+
+#include "Camera.h"
+#include "Framebuffer.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "TileScheduler.h"
+
+// Rays that go through a stage at once, roughly. The image is traced in
+// bands of rows with about this many camera rays in each.
+const int WAVEFRONT_BATCH_SIZE = 1 << 16;
+
+// Rays per chunk of a stage's parallel loop (a multiple of RayPacket::SIZE)
+const int WAVEFRONT_CHUNK_SIZE = 1024;
+
+// What raytraceImage does for RenderSettings::wavefront, after the preview
+bool raytraceImageWavefront(Scene const &scene, Framebuffer &image, CameraRays const &camera, TileScheduler &scheduler, RenderSettings const &settings, std::atomic<bool> const *cancel);
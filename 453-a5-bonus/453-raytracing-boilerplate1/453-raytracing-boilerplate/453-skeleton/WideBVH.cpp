@@ -0,0 +1,157 @@
+#include "WideBVH.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Largest leaf a child can hold (WideBVHNode::count is 16 bits). Bigger ones
+// only come from primitives the builder couldn't tell apart, and get split.
+const int MAX_WIDE_LEAF = 0xFFFF;
+
+} // namespace
+
+void WideBVH::build(BVH const &binary) {
+	pages = nullptr;
+	rootBounds = AABB();
+	building.clear();
+	if (!binary.empty()) {
+		rootBounds = binary.nodes[0].bounds;
+		building.reserve(binary.nodes.size() / 3 + 1);
+		BVHNode const &root = binary.nodes[0];
+		if (root.isLeaf()) {
+			leafRange(root.bounds, root.first, root.count);
+		} else {
+			collapse(binary, 0);
+		}
+	}
+	nodes.assign(std::move(building));
+	building = std::vector<WideBVHNode>();
+}
+
+void WideBVH::view(PageBudget *budget, size_t offset, int count, AABB const &bounds) {
+	nodes.view(reinterpret_cast<WideBVHNode const *>(budget->file().data() + offset), count);
+	rootBounds = bounds;
+	pages = budget;
+	pagesOffset = offset;
+}
+
+int WideBVH::collapse(BVH const &binary, int node) {
+	int index = static_cast<int>(building.size());
+	building.emplace_back();
+
+	// Start from the two children and keep opening up the biggest interior
+	// one (the one rays are most likely to visit) until there are four
+	int children[WideBVHNode::WIDTH] = { binary.nodes[node].first, binary.nodes[node].first + 1 };
+	int childCount = 2;
+	while (childCount < WideBVHNode::WIDTH) {
+		int widest = -1;
+		float widestArea = -1.0f;
+		for (int i = 0; i < childCount; i++) {
+			BVHNode const &child = binary.nodes[children[i]];
+			if (!child.isLeaf() && child.bounds.surfaceArea() > widestArea) {
+				widest = i;
+				widestArea = child.bounds.surfaceArea();
+			}
+		}
+		if (widest < 0) {
+			break;
+		}
+		int opened = children[widest];
+		children[widest] = binary.nodes[opened].first;
+		children[childCount++] = binary.nodes[opened].first + 1;
+	}
+
+	AABB childBounds[WideBVHNode::WIDTH];
+	int first[WideBVHNode::WIDTH];
+	int count[WideBVHNode::WIDTH];
+	for (int i = 0; i < childCount; i++) {
+		BVHNode const &child = binary.nodes[children[i]];
+		childBounds[i] = child.bounds;
+		if (!child.isLeaf()) {
+			first[i] = collapse(binary, children[i]);
+			count[i] = 0;
+		} else if (child.count <= MAX_WIDE_LEAF) {
+			first[i] = child.first;
+			count[i] = child.count;
+		} else {
+			first[i] = leafRange(child.bounds, child.first, child.count);
+			count[i] = 0;
+		}
+	}
+	setChildren(index, binary.nodes[node].bounds, childBounds, first, count, childCount);
+	return index;
+}
+
+int WideBVH::leafRange(AABB const &bounds, int first, int count) {
+	// A node over a leaf too big for one child, or a root that is a leaf.
+	// The pieces can't be told apart anyway, so they all get the leaf's box.
+	int index = static_cast<int>(building.size());
+	building.emplace_back();
+
+	AABB childBounds[WideBVHNode::WIDTH];
+	int childFirst[WideBVHNode::WIDTH];
+	int childCount[WideBVHNode::WIDTH];
+	int pieces = std::min(WideBVHNode::WIDTH, (count + MAX_WIDE_LEAF - 1) / MAX_WIDE_LEAF);
+	int pieceSize = (count + pieces - 1) / pieces;
+	for (int i = 0; i < pieces; i++) {
+		int begin = first + i * pieceSize;
+		int size = std::min(pieceSize, first + count - begin);
+		childBounds[i] = bounds;
+		if (size <= MAX_WIDE_LEAF) {
+			childFirst[i] = begin;
+			childCount[i] = size;
+		} else {
+			childFirst[i] = leafRange(bounds, begin, size);
+			childCount[i] = 0;
+		}
+	}
+	setChildren(index, bounds, childBounds, childFirst, childCount, pieces);
+	return index;
+}
+
+void WideBVH::setChildren(int index, AABB const &bounds, AABB const *childBounds, int const *first, int const *count, int childCount) {
+	WideBVHNode &node = building[index];
+	node.origin = bounds.min;
+	node.childCount = static_cast<uint8_t>(childCount);
+
+	for (int axis = 0; axis < 3; axis++) {
+		// The smallest power of two spacing that fits the box in 255 steps
+		float extent = bounds.max[axis] - bounds.min[axis];
+		int exponent = -126;
+		if (extent > 0.0f) {
+			exponent = std::max(-126, static_cast<int>(std::ceil(std::log2(extent / 255.0f))));
+		}
+		node.exponent[axis] = static_cast<int8_t>(std::min(exponent, 127));
+		while (node.exponent[axis] < 127 && node.origin[axis] + 255.0f * node.spacing(axis) < bounds.max[axis]) {
+			node.exponent[axis]++;
+		}
+		float spacing = node.spacing(axis);
+
+		// Round every child box outwards onto the grid. The checks use the
+		// same arithmetic as the traversal, so the boxes it sees are never
+		// smaller than the real ones.
+		for (int i = 0; i < WideBVHNode::WIDTH; i++) {
+			int lo = 0, hi = 0;
+			if (i < childCount) {
+				lo = static_cast<int>(std::floor((childBounds[i].min[axis] - node.origin[axis]) / spacing));
+				lo = std::min(std::max(lo, 0), 255);
+				while (lo > 0 && node.origin[axis] + float(lo) * spacing > childBounds[i].min[axis]) {
+					lo--;
+				}
+				hi = static_cast<int>(std::ceil((childBounds[i].max[axis] - node.origin[axis]) / spacing));
+				hi = std::min(std::max(hi, 0), 255);
+				while (hi < 255 && node.origin[axis] + float(hi) * spacing < childBounds[i].max[axis]) {
+					hi++;
+				}
+			}
+			node.lo[axis][i] = static_cast<uint8_t>(lo);
+			node.hi[axis][i] = static_cast<uint8_t>(hi);
+		}
+	}
+
+	for (int i = 0; i < WideBVHNode::WIDTH; i++) {
+		node.first[i] = i < childCount ? first[i] : 0;
+		node.count[i] = static_cast<uint16_t>(i < childCount ? count[i] : 0);
+	}
+}
@@ -0,0 +1,270 @@
+//------------------------------------------------------------------------------
+// A compressed, 4 wide version of a BVH, for the big per-mesh hierarchies.
+//
+// Every node holds the boxes of up to four children, and stores them with 8
+// bits per side on a grid laid over the node's own box (the grid spacing is a
+// power of two per axis, so the boxes come out exact and never smaller than
+// the real ones). A node is 64 bytes, one cache line, where a binary BVH
+// needs three 32 byte nodes for the same four children, and leaves don't
+// need a node of their own at all. A ray tests all four children at once
+// with SSE.
+//
+// It is made by collapsing a binary BVH (built with the surface area
+// heuristic as usual), and keeps its leaves and primitive order. The nodes
+// can also be read straight from a mapped mesh file (see MeshFile.h).
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "BVH.h"
+#include "MappedArray.h"
+#include "PageBudget.h"
+#include "Ray.h"
+#include "RayPacket.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RT_WIDE_BVH_SSE 1
+#include <immintrin.h>
+#endif
+
+struct alignas(64) WideBVHNode {
+	static const int WIDTH = 4;
+
+	glm::vec3 origin;          // lower corner of the grid the child boxes are on
+	int8_t exponent[3];        // grid spacing along each axis is 2^exponent
+	uint8_t childCount;
+	uint8_t lo[3][WIDTH];      // child i spans origin + lo[axis][i] * spacing
+	uint8_t hi[3][WIDTH];      //           to origin + hi[axis][i] * spacing
+	int32_t first[WIDTH];      // interior child: its node, leaf: its first primitive
+	uint16_t count[WIDTH];     // leaf: number of primitives, interior child: 0
+
+	float spacing(int axis) const {
+		// 2^exponent, straight from the bits
+		uint32_t bits = uint32_t(exponent[axis] + 127) << 23;
+		float value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	AABB childBounds(int i) const {
+		AABB box;
+		for (int axis = 0; axis < 3; axis++) {
+			box.min[axis] = origin[axis] + float(lo[axis][i]) * spacing(axis);
+			box.max[axis] = origin[axis] + float(hi[axis][i]) * spacing(axis);
+		}
+		return box;
+	}
+};
+
+class WideBVH {
+public:
+	MappedArray<WideBVHNode> nodes; // nodes[0] is the root
+
+	// Collapses the binary BVH into this one. Leaves refer to the same
+	// primitives: [first, first + count) of binary.primitives.
+	void build(BVH const &binary);
+
+	// Uses `count` nodes that live at `offset` in budget's file, and reports
+	// every node a traversal visits to the budget
+	void view(PageBudget *budget, size_t offset, int count, AABB const &bounds);
+
+	bool empty() const { return nodes.empty(); }
+	AABB const &bounds() const { return rootBounds; }
+	size_t memoryBytes() const { return nodes.size() * sizeof(WideBVHNode); }
+
+	// Same as the BVH traversals, but the leaves are handed over as a range
+	// of primitives: intersectLeaf(first, count, tMax) and so on.
+	template <typename F>
+	void traverseLeaves(Ray const &ray, float &tMax, F &&intersectLeaf) const;
+	template <typename F>
+	bool traverseLeavesAny(Ray const &ray, float tMax, F &&occludedLeaf) const;
+	template <typename F>
+	void traversePacket(RayPacket const &packet, uint32_t active, float *tMax, F &&intersectLeaf) const;
+
+private:
+	AABB rootBounds;
+	PageBudget *pages = nullptr; // set if the nodes are in a mapped file
+	size_t pagesOffset = 0;      // where in it
+	std::vector<WideBVHNode> building;
+
+	WideBVHNode const &node(int index) const {
+		if (pages) {
+			pages->touch(pagesOffset + size_t(index) * sizeof(WideBVHNode), sizeof(WideBVHNode));
+		}
+		return nodes[index];
+	}
+
+	int collapse(BVH const &binary, int node);
+	int leafRange(AABB const &bounds, int first, int count);
+	void setChildren(int node, AABB const &bounds, AABB const *childBounds, int const *first, int const *count, int childCount);
+};
+
+// Tests the ray against all of the node's children. Returns a bit for each
+// child it enters before tMax, with where it enters in tNear[child].
+inline uint32_t intersectChildren(WideBVHNode const &node, glm::vec3 origin, glm::vec3 invDir, float tMax, float *tNear) {
+#ifdef RT_WIDE_BVH_SSE
+	auto grid = [&](uint8_t const *q, int axis, float o, float inv) {
+		int32_t packed;
+		std::memcpy(&packed, q, sizeof(packed));
+		__m128i zero = _mm_setzero_si128();
+		__m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+		__m128 side = _mm_add_ps(_mm_set1_ps(node.origin[axis]), _mm_mul_ps(_mm_cvtepi32_ps(wide), _mm_set1_ps(node.spacing(axis))));
+		return _mm_mul_ps(_mm_sub_ps(side, _mm_set1_ps(o)), _mm_set1_ps(inv));
+	};
+	__m128 t0x = grid(node.lo[0], 0, origin.x, invDir.x), t1x = grid(node.hi[0], 0, origin.x, invDir.x);
+	__m128 t0y = grid(node.lo[1], 1, origin.y, invDir.y), t1y = grid(node.hi[1], 1, origin.y, invDir.y);
+	__m128 t0z = grid(node.lo[2], 2, origin.z, invDir.z), t1z = grid(node.hi[2], 2, origin.z, invDir.z);
+	__m128 nearT = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_setzero_ps()));
+	__m128 farT = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(tMax)));
+	_mm_storeu_ps(tNear, nearT);
+	uint32_t hits = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(nearT, farT)));
+	return hits & ((1u << node.childCount) - 1);
+#else
+	uint32_t hits = 0;
+	for (int i = 0; i < node.childCount; i++) {
+		if (node.childBounds(i).intersect(origin, invDir, tMax, tNear[i])) {
+			hits |= 1u << i;
+		}
+	}
+	return hits;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+
+template <typename F>
+void WideBVH::traverseLeaves(Ray const &ray, float &tMax, F &&intersectLeaf) const {
+	if (nodes.empty()) {
+		return;
+	}
+
+	glm::vec3 invDir = 1.0f / ray.direction;
+	float tRoot;
+	if (!rootBounds.intersect(ray.origin, invDir, tMax, tRoot)) {
+		return;
+	}
+
+	// Leaves go on the stack too (count > 0), so that everything is visited
+	// nearest first. A node pushes at most three more entries than it pops.
+	struct Entry { int first; int count; float tNear; };
+	Entry stack[3 * 128];
+	int size = 0;
+	stack[size++] = { 0, 0, tRoot };
+
+	while (size > 0) {
+		Entry e = stack[--size];
+		if (e.tNear > tMax) {
+			continue;
+		}
+		if (e.count > 0) {
+			intersectLeaf(e.first, e.count, tMax);
+			continue;
+		}
+
+		WideBVHNode const &node = this->node(e.first);
+		float tNear[WideBVHNode::WIDTH];
+		uint32_t hits = intersectChildren(node, ray.origin, invDir, tMax, tNear);
+
+		// Push the children furthest first, so the nearest is popped next
+		Entry children[WideBVHNode::WIDTH];
+		int n = 0;
+		for (int i = 0; i < node.childCount; i++) {
+			if ((hits >> i) & 1u) {
+				Entry child = { node.first[i], node.count[i], tNear[i] };
+				int j = n++;
+				for (; j > 0 && children[j - 1].tNear < child.tNear; j--) {
+					children[j] = children[j - 1];
+				}
+				children[j] = child;
+			}
+		}
+		for (int i = 0; i < n; i++) {
+			stack[size++] = children[i];
+		}
+	}
+}
+
+template <typename F>
+bool WideBVH::traverseLeavesAny(Ray const &ray, float tMax, F &&occludedLeaf) const {
+	if (nodes.empty()) {
+		return false;
+	}
+
+	glm::vec3 invDir = 1.0f / ray.direction;
+	float tRoot;
+	if (!rootBounds.intersect(ray.origin, invDir, tMax, tRoot)) {
+		return false;
+	}
+
+	int stack[3 * 128];
+	int size = 0;
+	stack[size++] = 0;
+
+	while (size > 0) {
+		WideBVHNode const &node = this->node(stack[--size]);
+		float tNear[WideBVHNode::WIDTH];
+		uint32_t hits = intersectChildren(node, ray.origin, invDir, tMax, tNear);
+		for (int i = 0; i < node.childCount; i++) {
+			if (!((hits >> i) & 1u)) {
+				continue;
+			}
+			if (node.count[i] > 0) {
+				if (occludedLeaf(node.first[i], node.count[i])) {
+					return true;
+				}
+			} else {
+				stack[size++] = node.first[i];
+			}
+		}
+	}
+	return false;
+}
+
+template <typename F>
+void WideBVH::traversePacket(RayPacket const &packet, uint32_t active, float *tMax, F &&intersectLeaf) const {
+	if (nodes.empty()) {
+		return;
+	}
+
+	float tRoot;
+	uint32_t rootLanes = packet.intersect(rootBounds, active, tMax, tRoot);
+	if (!rootLanes) {
+		return;
+	}
+
+	// Lanes that reached a child are remembered with it, as in BVH::traversePacket
+	struct Entry { int first; int count; uint32_t lanes; float tNear; };
+	Entry stack[3 * 128];
+	int size = 0;
+	stack[size++] = { 0, 0, rootLanes, tRoot };
+
+	while (size > 0) {
+		Entry e = stack[--size];
+		if (e.count > 0) {
+			intersectLeaf(e.first, e.count, e.lanes);
+			continue;
+		}
+
+		WideBVHNode const &node = this->node(e.first);
+		Entry children[WideBVHNode::WIDTH];
+		int n = 0;
+		for (int i = 0; i < node.childCount; i++) {
+			float tNear;
+			uint32_t lanes = packet.intersect(node.childBounds(i), e.lanes, tMax, tNear);
+			if (lanes) {
+				Entry child = { node.first[i], node.count[i], lanes, tNear };
+				int j = n++;
+				for (; j > 0 && children[j - 1].tNear < child.tNear; j--) {
+					children[j] = children[j - 1];
+				}
+				children[j] = child;
+			}
+		}
+		for (int i = 0; i < n; i++) {
+			stack[size++] = children[i];
+		}
+	}
+}
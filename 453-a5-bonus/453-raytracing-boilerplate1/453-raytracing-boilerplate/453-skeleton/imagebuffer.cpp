@@ -21,18 +21,13 @@
 
 #include "imagebuffer.h"
 
-
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb/stb_image_write.h"
-
 using namespace std;
 using namespace glm;
 
 // --------------------------------------------------------------------------
 
 ImageBuffer::ImageBuffer()
-    : m_textureName(0), m_framebufferObject(0),
-      m_width(0), m_height(0), m_modified(false)
+    : m_textureName(0), m_framebufferObject(0)
 {
 }
 
@@ -41,13 +36,6 @@ ImageBuffer::~ImageBuffer()
     Destroy();
 }
 
-void ImageBuffer::ResetModified()
-{
-    m_modified = false;
-    m_modifiedLower = m_height;
-    m_modifiedUpper = 0;
-}
-
 // --------------------------------------------------------------------------
 
 bool ImageBuffer::Initialize()
@@ -55,27 +43,15 @@ bool ImageBuffer::Initialize()
     // retrieve the current viewport size
     GLint viewport[4];
     glGetIntegerv(GL_VIEWPORT, viewport);
-    m_width = viewport[2];
-    m_height = viewport[3];
-
-    // allocate image data
-    m_imageData.resize(m_width * m_height);
-    for (int i = 0, k = 0; i < m_height; ++i)
-        for (int j = 0; j < m_width; ++j, ++k)
-        {
-            int p = (i >> 4) + (j >> 4);
-            float c = 0.2 + ((p & 1) ? 0.1f : 0.0f);
-            m_imageData[k] = vec3(c);
-        }
+    m_pixels.Resize(viewport[2], viewport[3]);
 
     // allocate texture object
     if (!m_textureName)
         glGenTextures(1, &m_textureName);
     glBindTexture(GL_TEXTURE_RECTANGLE, m_textureName);
-    glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_RGB, m_width, m_height, 0, GL_RGB,
-                 GL_FLOAT, &m_imageData[0]);
+    glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_RGB, Width(), Height(), 0, GL_RGB,
+                 GL_FLOAT, m_pixels.Data());
     glBindTexture(GL_TEXTURE_RECTANGLE, 0);
-    ResetModified();
 
     // allocate framebuffer object
     if (!m_framebufferObject)
@@ -107,85 +83,24 @@ void ImageBuffer::Destroy()
 
 // --------------------------------------------------------------------------
 
-void ImageBuffer::SetPixel(int x, int y, vec3 colour)
-{
-    int index = y * m_width + x;
-    m_imageData[index] = colour;
-
-    // mark that something was changed
-    m_modified = true;
-    m_modifiedLower = std::min(m_modifiedLower, y);
-    m_modifiedUpper = std::max(m_modifiedUpper, y+1);
-}
-
-// --------------------------------------------------------------------------
-
 void ImageBuffer::Render()
 {
     if (!m_framebufferObject) return;
 
     // check for modifications to the image data and update texture as needed
-    if (m_modified)
+    m_pixels.TakeModifiedRows([&](int lower, int upper, const vec3 *rows)
     {
-        int sizeY = m_modifiedUpper - m_modifiedLower;
-        int index = m_modifiedLower * m_width;
-
         // bind texture and copy only the rows that have been changed
         glBindTexture(GL_TEXTURE_RECTANGLE, m_textureName);
-        glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, 0, m_modifiedLower, m_width,
-                        sizeY, GL_RGB, GL_FLOAT, &m_imageData[index]);
+        glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, 0, lower, Width(),
+                        upper - lower, GL_RGB, GL_FLOAT, rows);
         glBindTexture(GL_TEXTURE_RECTANGLE, 0);
-
-        // mark that we've updated the texture
-        ResetModified();
-    }
+    });
 
     // bind the framebuffer object with our texture in it and copy to screen
     glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebufferObject);
-    glBlitFramebuffer(0, 0, m_width, m_height,
-                      0, 0, m_width, m_height,
+    glBlitFramebuffer(0, 0, Width(), Height(),
+                      0, 0, Width(), Height(),
                       GL_COLOR_BUFFER_BIT, GL_NEAREST);
     glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
 }
-
-// --------------------------------------------------------------------------
-
-bool ImageBuffer::SaveToFile(const string &imageFileName)
-{
-    if (m_width == 0 || m_height == 0)
-    {
-        cout << "ImageBuffer ERROR: Trying to save uninitialized image!" << endl;
-        return false;
-    }
-    cout << "ImageBuffer saving image to " << imageFileName << "..." << endl;
-
-    const unsigned numComponents = 3; //RGB
-    unsigned char* pixels = new unsigned char[m_width*m_height*numComponents];
-
-    for (int y = 0; y < m_height; ++y)
-        for (int x = 0; x < m_width; ++x)
-        {
-            glm::vec3& color = m_imageData[y * m_width + x];
-            int i = (m_height - 1 - y) * m_width + x;
-            i *= numComponents;
-
-            pixels[i]     = (unsigned char) (255 * clamp(color.r, 0.f, 1.f));	// red
-            pixels[i + 1] = (unsigned char) (255 * clamp(color.g, 0.f, 1.f));	// green
-            pixels[i + 2] = (unsigned char) (255 * clamp(color.b, 0.f, 1.f));	// blue
-        }
-
-    // Save the image to disk
-    int stride = 0;
-    if (!stbi_write_png(imageFileName.data(), m_width, m_height, numComponents, pixels, stride))
-    {
-        // Fail! delete and exit
-        cout << "STB failed to write image " << imageFileName << endl;
-        delete[] pixels;
-        return false;
-    }
-
-    //success, delete and exit
-    delete[] pixels;
-    return true;
-}
-
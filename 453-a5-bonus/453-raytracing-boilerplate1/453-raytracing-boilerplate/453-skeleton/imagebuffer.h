@@ -12,10 +12,11 @@
 #ifndef IMAGEBUFFER_H
 #define IMAGEBUFFER_H
 
-#include <vector>
 #include <string>
 #include <glm/vec3.hpp>
 
+#include "Framebuffer.h"
+
 #ifndef GLFW_VERSION_MAJOR
 #include <glad/glad.h>
 //#define GLFW_INCLUDE_GLCOREARB
@@ -24,9 +25,9 @@
 #endif
 
 // --------------------------------------------------------------------------
-// This class encapsulates functionality for setting pixel colours in an
-// image memory buffer, copying the buffer into an OpenGL window for display,
-// and saving the buffer to disk as an image file.
+// This class copies the pixels of a Framebuffer into an OpenGL window for
+// display. The Framebuffer holds the image itself, and also does the
+// setting of pixel colours and saving to disk.
 
 class ImageBuffer
 {
@@ -34,23 +35,20 @@ class ImageBuffer
     GLuint  m_textureName;
     GLuint  m_framebufferObject;
 
-    // dimensions of our image, and the pixel colour data array
-    int     m_width, m_height;
-    std::vector<glm::vec3> m_imageData;
-
-    // state variables to keep track of modified region
-    bool    m_modified;
-    int     m_modifiedLower, m_modifiedUpper;
-
-    void ResetModified();
+    // the image on the CPU side, which is what the ray tracer renders into
+    Framebuffer m_pixels;
 
 public:
     ImageBuffer();
     ~ImageBuffer();
 
     // returns the width or height of the currently allocated image
-    int Width() const  { return m_width; }
-    int Height() const { return m_height; }
+    int Width() const  { return m_pixels.Width(); }
+    int Height() const { return m_pixels.Height(); }
+
+    // the pixels shown by this buffer. Render threads can write to it while
+    // Render() is being called.
+    Framebuffer &Pixels() { return m_pixels; }
 
     // call this after your OpenGL context is all set up to create an image
     // buffer that matches the size of your viewport
@@ -62,13 +60,13 @@ public:
     // set a pixel in this image buffer to a specified colour:
     //  - (0,0) is the bottom-left pixel of the image
     //  - colour is RGB given as floating point numbers in the range [0,1]
-    void SetPixel(int x, int y, glm::vec3 colour);
+    void SetPixel(int x, int y, glm::vec3 colour) { m_pixels.SetPixel(x, y, colour); }
 
     // call this in your render function to copy this image onto your screen
     void Render();
 
     // call this at the end of your render to save the image to file
-    bool SaveToFile(const std::string &imageFileName);
+    bool SaveToFile(const std::string &imageFileName) { return m_pixels.SaveToFile(imageFileName); }
 };
 
 // --------------------------------------------------------------------------
@@ -9,6 +9,8 @@
 
 #include <glm/gtx/vector_query.hpp>
 
+#include <argh.h>
+
 #include "Geometry.h"
 #include "GLDebug.h"
 #include "Log.h"
@@ -20,235 +22,188 @@
 #include "RayTrace.h"
 #include "Scene.h"
 #include "Lighting.h"
+#include "Renderer.h"
+#include "RenderJob.h"
+#include "TileScheduler.h"
 
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_glfw.h"
 #include "imgui/imgui_impl_opengl3.h"
 
 
-int hasIntersection(Scene const &scene, Ray ray, int skipID){
-	for (auto &shape : scene.shapesInScene) {
-		Intersection tmp = shape->getIntersection(ray);
-		if(
-			shape->id != skipID
-			&& tmp.numberOfIntersections!=0
-			&& glm::distance(tmp.point, ray.origin) > 0.00001
-			&& glm::distance(tmp.point, ray.origin) < glm::distance(ray.origin, scene.lightPosition) - 0.01
-		){
-			return tmp.id;
-		}
-	}
-	return -1;
-}
+// EXAMPLE CALLBACKS
+class Assignment5 : public CallbackInterface {
 
-Intersection getClosestIntersection(Scene const &scene, Ray ray, int skipID){ //get the nearest
-	Intersection closestIntersection;
-	float min = std::numeric_limits<float>::max();
-	for(auto &shape : scene.shapesInScene) {
-		if(skipID == shape->id) {
-			// Sometimes you need to skip certain shapes. Useful to
-			// avoid self-intersection. ;)
-			continue;
-		}
-		Intersection p = shape->getIntersection(ray);
-		float distance = glm::distance(p.point, ray.origin);
-		if(p.numberOfIntersections !=0 && distance < min){
-			min = distance;
-			closestIntersection = p;
-		}
+public:
+	Assignment5(int threads, RenderSettings settings)
+		: scheduler(threads)
+		, settings(settings)
+	{
+		Log::info("Ray tracing with {} threads", scheduler.threadCount());
+		Log::info("Triangle kernel: {}", triangleKernelName(activeTriangleKernel()));
+		viewPoint = glm::vec3(0, 0, 1.3); //had to zoom in z
+		startRender(initScene1());
 	}
-	return closestIntersection;
-}
 
-
-glm::vec3 raytraceSingleRay(Scene const &scene, Ray const &ray, int level, int source_id) {
-	// TODO: Part 3: Somewhere in this function you will need to add the code to determine
-	//               if a given point is in shadow or not. Think carefully about what parts
-	//               of the lighting equation should be used when a point is in shadow.
-	// TODO: Part 4: Somewhere in this function you will need to add the code that does reflections and refractions.
-	//               NOTE: The ObjectMaterial class already has a parameter to store the object's
-	//               reflective properties. Use this parameter + the color coming back from the
-	//               reflected array and the color from the phong shading equation.
-	Intersection result = getClosestIntersection(scene, ray, source_id); //find intersection
-
-	//return local color on recursion limit
-	if (level < 1) {
-		PhongReflection phong;
-		phong.ray = ray;
-		phong.scene = scene;
-		phong.material = result.material;
-		phong.intersection = result;
-		return phong.I();
+	// Ray traces the scene in the background. The render loop keeps calling
+	// outputImage.Render() in the meantime, which uploads every tile as soon
+	// as it is finished. A render that is still going when this is called
+	// again (say, the scene was switched halfway through) is called off.
+	void startRender(Scene newScene) {
+		supersede(render, [&] {
+			outputImage.Initialize(); // needs the OpenGL context, so not on the render thread
+			return std::make_unique<RenderJob>(std::move(newScene), outputImage.Pixels(), viewPoint, scheduler, settings, &primaryHits, &dependencies);
+		});
 	}
 
-	PhongReflection phong;
-	phong.ray = ray;
-	phong.scene = scene;
-	phong.material = result.material;
-	phong.intersection = result;
-	glm::vec3 finalColor(0.0f);
-
-	if(result.numberOfIntersections == 0) return glm::vec3(0, 0, 0); // black;
-
-	
-
-	//part 3
-	vec3 lightDirection = glm::normalize(scene.lightPosition - result.point);
-	Ray shadowRay(result.point + result.normal * 0.001f, lightDirection);
-	int shadowIntersection = hasIntersection(scene, shadowRay, result.id);
-
-	if (shadowIntersection != -1) { //in shadow, only use ambient component of material
-		finalColor = phong.Ia();
-	}
-	else {
-		finalColor = phong.I();
+	// Moves the light, and lights the image again from the camera hits of the
+	// last render instead of rendering it from scratch (if that render got
+	// to finish, that is).
+	void moveLight(glm::vec3 offset) {
+		Scene newScene = render->scene(); // shares the shapes and BVH, so it's cheap
+		newScene.lightPosition += offset;
+		supersede(render, [&]() -> std::unique_ptr<RenderJob> {
+			if (!primaryHits.valid) {
+				outputImage.Initialize();
+				return std::make_unique<RenderJob>(std::move(newScene), outputImage.Pixels(), viewPoint, scheduler, settings, &primaryHits, &dependencies);
+			}
+			dependencies.valid = false; // the shadow rays go somewhere else now
+			return std::make_unique<RenderJob>(std::move(newScene), outputImage.Pixels(), primaryHits, scheduler, settings);
+		});
 	}
 
-	//part 4
-	//reflection
-	float avgReflection = (phong.material.reflectionStrength.r + phong.material.reflectionStrength.g + phong.material.reflectionStrength.b) / 3.0f;
-	if (avgReflection > 0.0f) {
-		glm::vec3 D = ray.direction;
-		glm::vec3 N = result.normal;
-		glm::vec3 reflectionDir = D - 2.0f * glm::dot(D, N) * N; //R = D - 2(N*D)N
-		Ray reflectRay(result.point + N * 0.001f, reflectionDir);
-		glm::vec3 reflectionColor(0.0f);
-		reflectionColor = raytraceSingleRay(scene, reflectRay, level - 1, result.id);
-		finalColor = (1.0f - avgReflection) * finalColor + avgReflection * reflectionColor;
+	// Traces the tiles that depended on shape k again, after it was edited
+	// in newScene (a copy of the scene being shown)
+	void editShape(Scene newScene, int k) {
+		Scene oldScene = render->scene();
+		supersede(render, [&] {
+			return std::make_unique<RenderJob>(std::move(newScene), std::move(oldScene), std::vector<int>{ k }, outputImage.Pixels(), scheduler, dependencies, settings, &primaryHits);
+		});
 	}
 
-	//refraction
-	if (phong.material.refractiveIndex > 1.0f) {
-		float etai = 1.0f;
-		float etat = phong.material.refractiveIndex;
-		glm::vec3 N = result.normal;
-		float cosi = glm::dot(ray.direction, N);
-
-		//ray inside object
-		if (cosi > 0.0f) {
-			std::swap(etai, etat);
-			N = -N;
-			cosi = glm::dot(ray.direction, N);
+	// The first sphere of the scene being shown, if it has one
+	int firstSphere() const {
+		auto const &shapes = render->scene().shapesInScene;
+		for (int i = 0; i < static_cast<int>(shapes.size()); i++) {
+			if (std::dynamic_pointer_cast<Sphere>(shapes[i])) {
+				return i;
+			}
 		}
-
-		float eta = etai / etat;
-		float k = 1.0f - eta * eta * (1.0f - cosi * cosi);
-		glm::vec3 refractionColor(0.0f);
-		glm::vec3 refractionDir;
-		if (k < 0.0f) {
-			glm::vec3 D = ray.direction;
-			refractionDir = D - 2.0f * glm::dot(D, N) * N;
-		}
-		else {
-			refractionDir = eta * ray.direction + (eta * cosi - sqrtf(k)) * N;
-		}
-
-		refractionDir = glm::normalize(refractionDir);
-		Ray refractionRay(result.point - N * 0.001f, refractionDir);
-		refractionColor = raytraceSingleRay(scene, refractionRay, level - 1, result.id);
-
-		finalColor = (1.0f - 0.5f) * finalColor + 0.5f * refractionColor;
+		return -1;
 	}
 
-	return finalColor;
-}
-
-struct RayAndPixel {
-	Ray ray;
-	int x;
-	int y;
-};
-
-std::vector<RayAndPixel> getRaysForViewpoint(Scene const &scene, ImageBuffer &image, glm::vec3 viewPoint) {
-
-	//part 1
-	std::vector<RayAndPixel> rays;
-	int width = image.Width();
-	int height = image.Height();
-	float aspectRatio = static_cast<float>(width) / height;
-
-	for (int x = 0; x < width; x++) {
-		for (int y = 0; y < height; y++) {
-			float fov = M_PI / 2.0f; 
-			float scale = tan(fov / 2.0f);
-			float u = (2.0f * (x+0.5f) / float(width) - 1.0f) * scale * aspectRatio;
-			float v = (2.0f * y / float(height) - 1.0f) * scale;
-
-			//image plane point
-			glm::vec3 imagePlanePoint(u, v, -1.0f);
+	virtual void keyCallback(int key, int scancode, int action, int mods) {
+		if (key == GLFW_KEY_Q && action == GLFW_PRESS) {
+			shouldQuit = true;
+		}
 
-			//generate ray
-			glm::vec3 direction = glm::normalize(imagePlanePoint - viewPoint);
-			Ray r = Ray(viewPoint, direction);
-			rays.push_back({ r, x, y });
+		if (key == GLFW_KEY_1 && action == GLFW_PRESS) {
+			startRender(initScene1());
 		}
-	}
-	return rays;
-}
 
-void raytraceImage(Scene const &scene, ImageBuffer &image, glm::vec3 viewPoint) {
-	// Reset the image to the current size of the screen.
-	image.Initialize();
-
-	// Get the set of rays to cast for this given image / viewpoint
-	std::vector<RayAndPixel> rays = getRaysForViewpoint(scene, image, viewPoint);
-
-
-	// This loops processes each ray and stores the resulting pixel in the image.
-	// final color into the image at the appropriate location.
-	//
-	// I've written it this way, because if you're keen on this, you can
-	// try and parallelize this loop to ensure that your ray tracer makes use
-	// of all of your CPU cores
-	//
-	// Note, if you do this, you will need to be careful about how you render
-	// things below too
-	// std::for_each(std::begin(rays), std::end(rays), [&] (auto const &r) {
-	for (auto const & r : rays) {
-		glm::vec3 color = raytraceSingleRay(scene, r.ray, 5, -1);
-		image.SetPixel(r.x, r.y, color);
-	}
-}
+		if (key == GLFW_KEY_2 && action == GLFW_PRESS) {
+			startRender(initScene2());
+		}
 
-// EXAMPLE CALLBACKS
-class Assignment5 : public CallbackInterface {
+		if (key == GLFW_KEY_3 && action == GLFW_PRESS) {
+			startRender(initScene3());
+		}
 
-public:
-	Assignment5() {
-		viewPoint = glm::vec3(0, 0, 1.3); //had to zoom in z
-		scene = initScene1();
-		raytraceImage(scene, outputImage, viewPoint);
-	}
+		if (key == GLFW_KEY_4 && action == GLFW_PRESS) {
+			startRender(initScene4());
+		}
 
-	virtual void keyCallback(int key, int scancode, int action, int mods) {
-		if (key == GLFW_KEY_Q && action == GLFW_PRESS) {
-			shouldQuit = true;
+		// G switches the scene being shown between BVHs and a grid
+		if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+			Scene newScene = render->scene();
+			newScene.structure = newScene.structure == AccelStructure::Grid ? AccelStructure::BVH : AccelStructure::Grid;
+			buildSceneBVH(newScene);
+			Log::info("Tracing with {}", accelStructureName(newScene.structure));
+			startRender(std::move(newScene));
 		}
 
-		if (key == GLFW_KEY_1 && action == GLFW_PRESS) {
-			scene = initScene1();
-			raytraceImage(scene, outputImage, viewPoint);
+		// C gives the first sphere another colour, M moves it to the right
+		int sphere = firstSphere();
+		if (key == GLFW_KEY_C && action == GLFW_PRESS && sphere >= 0) {
+			Scene newScene = render->scene();
+			ObjectMaterial &material = newScene.materials[newScene.shapesInScene[sphere]->materialIndex];
+			const glm::vec3 palette[] = { { 0.8f, 0.2f, 0.2f }, { 0.2f, 0.8f, 0.2f }, { 0.2f, 0.2f, 0.8f }, { 0.6f, 0.6f, 0.6f } };
+			material.diffuse = palette[nextColour++ % 4];
+			editShape(std::move(newScene), sphere);
+		}
+		if (key == GLFW_KEY_M && action == GLFW_PRESS && sphere >= 0) {
+			Scene newScene = render->scene();
+			auto moved = std::make_shared<Sphere>(*std::static_pointer_cast<Sphere>(newScene.shapesInScene[sphere]));
+			moved->centre.x += 0.25f;
+			newScene.shapesInScene[sphere] = moved; // the old scene may still be tracing the old one
+			updateSceneBVH(newScene, { sphere });
+			editShape(std::move(newScene), sphere);
 		}
 
-		if (key == GLFW_KEY_2 && action == GLFW_PRESS) {
-			scene = initScene2();
-			raytraceImage(scene, outputImage, viewPoint);
+		// Arrow keys move the light left / right and forward / back,
+		// page up / down move it up and down
+		if (action == GLFW_PRESS || action == GLFW_REPEAT) {
+			const float step = 0.25f;
+			switch (key) {
+			case GLFW_KEY_LEFT: moveLight(glm::vec3(-step, 0, 0)); break;
+			case GLFW_KEY_RIGHT: moveLight(glm::vec3(step, 0, 0)); break;
+			case GLFW_KEY_UP: moveLight(glm::vec3(0, 0, -step)); break;
+			case GLFW_KEY_DOWN: moveLight(glm::vec3(0, 0, step)); break;
+			case GLFW_KEY_PAGE_UP: moveLight(glm::vec3(0, step, 0)); break;
+			case GLFW_KEY_PAGE_DOWN: moveLight(glm::vec3(0, -step, 0)); break;
+			}
 		}
 	}
 
 	bool shouldQuit = false;
 
+	TileScheduler scheduler;
+	RenderSettings settings;
 	ImageBuffer outputImage;
-	Scene scene;
 	glm::vec3 viewPoint;
+	GBuffer primaryHits; // what the camera rays of the last render hit
+	DependencyBuffer dependencies; // what each tile of it depended on
+	int nextColour = 0;
+	std::unique_ptr<RenderJob> render; // declared last, so it stops before the rest goes away
 
 };
 // END EXAMPLES
 
 
-int main() {
+int main(int argc, char **argv) {
 	Log::debug("Starting main");
 
+	// --threads N picks how many threads to ray trace with (default: all cores)
+	// --no-packets traces camera rays one at a time
+	// --preview N starts with one ray per NxN pixels (default: 8, 0 turns it off)
+	// --spp N traces N camera rays per pixel (default: 1)
+	// --adaptive only spends more than one ray on pixels near edges, up to --spp
+	// --threshold T is how different pixels may be before they get more rays (default: 0.05)
+	// --min-throughput W stops following reflections that add less than W to the pixel (default: 1/256)
+	// --roulette follows some of those anyway, weighted up to make up for the rest
+	// --wavefront traces big batches of rays a stage at a time instead of pixel by pixel
+	// --sort-rays sorts reflection and refraction rays by direction in wavefront mode
+	// --order tiled|morton|hilbert is the order tiles and the pixels in them are traced in
+	argh::parser cmdl(argc, argv, argh::parser::PREFER_PARAM_FOR_UNREG_OPTION);
+	int threads = 0;
+	cmdl("threads", 0) >> threads;
+	RenderSettings settings;
+	settings.packets = !cmdl["no-packets"];
+	cmdl("preview", 8) >> settings.previewBlockSize;
+	cmdl("spp", 1) >> settings.samplesPerPixel;
+	settings.adaptiveSampling = cmdl["adaptive"];
+	cmdl("threshold", 0.05f) >> settings.adaptiveThreshold;
+	cmdl("min-throughput", 1.0f / 256.0f) >> settings.minThroughput;
+	settings.russianRoulette = cmdl["roulette"];
+	settings.wavefront = cmdl["wavefront"];
+	settings.sortSecondaryRays = cmdl["sort-rays"];
+	std::string order;
+	cmdl("order", "tiled") >> order;
+	if (!parseTraversalOrder(order, settings.pixelOrder)) {
+		Log::error("Unknown pixel order {}, use tiled, morton or hilbert", order);
+		return 1;
+	}
+
 	// WINDOW
 	glfwInit();
 
@@ -260,7 +215,7 @@ int main() {
 	GLDebug::enable();
 
 	// CALLBACKS
-	std::shared_ptr<Assignment5> a5 = std::make_shared<Assignment5>(); // can also update callbacks to new ones
+	std::shared_ptr<Assignment5> a5 = std::make_shared<Assignment5>(threads, settings); // can also update callbacks to new ones
 	window.setCallbacks(a5); // can also update callbacks to new ones
 
 	// RENDER LOOP